@@ -0,0 +1,110 @@
+import json
+import os
+import re
+import subprocess
+import sys
+import time
+
+CORPUS = 'bench_corpus.txt'
+RESULTS = 'bench_results.json'
+BASELINE = 'bench_baseline.json'
+COMMAND = ['./solver_main', '--tt-mb', '256']
+
+
+def load_corpus(path):
+    corpus = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split()
+            if not fields or fields[0].startswith('#'):
+                continue
+            category, expected, toplay, boards = fields[0], int(fields[1]), fields[2], fields[3:]
+            name = category + ': ' + ' '.join(boards) + ' ' + toplay
+            corpus.append({'name': name, 'boards': boards, 'toplay': toplay, 'expected': expected})
+    return corpus
+
+
+# solve one position in a fresh process; wait4 gives the peak RSS of that process alone
+def solve(boards, toplay):
+    beg = time.time()
+    proc = subprocess.Popen(COMMAND + boards + [toplay], stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    out = proc.stdout.read()
+    err = proc.stderr.read()
+    _, status, usage = os.wait4(proc.pid, 0)
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    wall = time.time() - beg
+    if proc.returncode:
+        print(err)
+        return None
+
+    fields = out.split('\t')
+    tt = re.search(r'tt (\d+)/(\d+) entries', err)
+    return {
+        'result': int(fields[0]),
+        'wall_s': round(wall, 3),
+        'nodes': int(fields[2].split()[0]),
+        'tt_entries': int(tt.group(1)) if tt else 0,
+        'tt_capacity': int(tt.group(2)) if tt else 0,
+        'peak_rss_kb': usage.ru_maxrss,
+    }
+
+
+def ratio(new, old):
+    return "x%.2f" % (new / old) if old else "-"
+
+
+def main():
+    # bench.py [--save-baseline] [-- solver_main options...]
+    args = sys.argv[1:]
+    if '--' in args:
+        COMMAND.extend(args[args.index('--')+1:])
+        args = args[:args.index('--')]
+    save_baseline = '--save-baseline' in args
+    baseline = {}
+    if not save_baseline and os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = {p['name']: p for p in json.load(f)['positions']}
+
+    positions = []
+    failures = 0
+    print("position\tresult\twall\tnodes\ttt\trss\tvs baseline (wall, nodes)")
+    for entry in load_corpus(CORPUS):
+        run = solve(entry['boards'], entry['toplay'])
+        if run is None or run['result'] != entry['expected']:
+            failures += 1
+            print(entry['name'] + "\tFAILED")
+            continue
+        run['name'] = entry['name']
+        positions.append(run)
+
+        row = [entry['name'], str(run['result']), "%.2fs" % run['wall_s'], str(run['nodes']),
+               "%.1f%%" % (100.0 * run['tt_entries'] / max(run['tt_capacity'], 1)), "%dMB" % (run['peak_rss_kb'] // 1024)]
+        base = baseline.get(entry['name'])
+        if base:
+            row.append(ratio(run['wall_s'], base['wall_s']) + " " + ratio(run['nodes'], base['nodes']))
+        print("\t".join(row))
+
+    total = {
+        'wall_s': round(sum(p['wall_s'] for p in positions), 3),
+        'nodes': sum(p['nodes'] for p in positions),
+    }
+    print("total\t\t%.2fs\t%d" % (total['wall_s'], total['nodes']), end='')
+    common = [p for p in positions if p['name'] in baseline]
+    if common:
+        base_wall = sum(baseline[p['name']]['wall_s'] for p in common)
+        base_nodes = sum(baseline[p['name']]['nodes'] for p in common)
+        print("\t\t\t" + ratio(sum(p['wall_s'] for p in common), base_wall) + " " +
+              ratio(sum(p['nodes'] for p in common), base_nodes), end='')
+    print()
+
+    with open(BASELINE if save_baseline else RESULTS, 'w') as f:
+        json.dump({'command': COMMAND, 'total': total, 'positions': positions}, f, indent=2)
+        f.write('\n')
+
+    if failures:
+        print("%d positions failed" % failures)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -33,6 +33,8 @@ public:
 
     Point* begin() { return board; }
     Point* end() { return board+size; }
+    const Point* begin() const { return board; }
+    const Point* end() const { return board+size; }
 };
 
 inline Board::Board(int size)
@@ -105,27 +107,33 @@ inline Board simplify_board(const Board board)
     return cboard;
 }
 
-// split board
-inline std::vector<Board> split_board(const Board board)
+// split board into subboards, which has room for capacity boards; return # of subboards
+inline int split_board(const Board& board, Board* subboards, int capacity)
 {
-    std::vector<Board> subboards;
-
+    int num = 0;
     int size = (int)board.size;
     Color previous = board[0];
-    Board subboard;
-    subboard.push_back(board[0]);
+    subboards[0].clear();
+    subboards[0].push_back(board[0]);
     for (int i = 1; i < size; i++) {
         char c = board[i];
         if (c != EMPTY && c == opp_color(previous)) {
-            subboards.push_back(subboard);
-            subboard.clear();
+            num++;
+            assert(num < capacity);
+            subboards[num].clear();
         }
-        subboard.push_back(board[i]);
+        subboards[num].push_back(board[i]);
         previous = c;
     }
-    subboards.push_back(subboard);
+    return num + 1;
+}
 
-    return subboards;
+// split board
+inline std::vector<Board> split_board(const Board board)
+{
+    Board subboards[MAX_BOARD_LEN];
+    int num = split_board(board, subboards, MAX_BOARD_LEN);
+    return std::vector<Board>(subboards, subboards + num);
 }
 
 inline bool validate_board(Board board)
@@ -4,9 +4,16 @@
 #include <cstring>
 #include <signal.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <thread>
 
 #include "cache.hpp"
 #include "sumgame.hpp"
+#include "search_stats.hpp"
+#include "utils/parallel_for.hpp"
 
 uint64_t exponents[2*(MAX_NUM_EMPTY+1)+1];
 
@@ -15,17 +22,13 @@ const char outcome_class[5] = { 'W', 'P', 'B', 'N', 'U'};
 
 Cache::Cache()
 {
-    int total = 0, accum_size = 0;
-    for (int i = 1; i < MAX_NUM_EMPTY+1; i++) {
+    int64_t accum_size = 0;
+    for (int i = 1; i < MAX_DB_NUM_EMPTY+1; i++) {
         m_cache_sizes[i] = std::pow((double)3, i+1);
         m_accum_sizes[i] = accum_size;
-        total += m_cache_sizes[i];
         accum_size += m_cache_sizes[i];
     }
-    m_accum_sizes[MAX_NUM_EMPTY+1] = accum_size;
-    assert(m_accum_sizes[MAX_NUM_EMPTY+1] == total);
-
-    m_cache = new DBEntry[total];
+    m_accum_sizes[MAX_DB_NUM_EMPTY+1] = accum_size;
 
     exponents[0] = 1;
     for (int i = 1; i < 2*(MAX_NUM_EMPTY+1)+1; i++) {
@@ -35,61 +38,201 @@ Cache::Cache()
 
 Cache::~Cache()
 {
-    delete[] m_cache;
+    for (int n = 1; n < MAX_DB_NUM_EMPTY+1; n++) {
+        if (m_levels[n].entries)
+            munmap((void*)m_levels[n].entries, m_levels[n].size * sizeof(DBEntry));
+    }
 }
 
 void Cache::lookup(Game& g, bool equivalent_replace) const
 {
-    int hashcode = hash_func(g.get_board());
-    if (hashcode != -1) {
-        DBEntry entry = m_cache[hashcode];
-        if (equivalent_replace && entry.eq_idx != -1) {
-            g = Game(m_cache[entry.eq_idx].board);
-            g.b_computed = g.w_computed = true;
-            g.b_wins = m_cache[entry.eq_idx].b_wins;
-            g.w_wins = m_cache[entry.eq_idx].w_wins;
-            return;
-        }
+    int num_empty;
+    int64_t idx = rank(g.m_board, num_empty);
+    if (idx == -1) {
+        STATS_INC(STAT_DB_MISSES);
+        return;
+    }
+    STATS_INC(STAT_DB_HITS);
+
+    const DBEntry& entry = m_levels[num_empty].entries[idx];
+    if (equivalent_replace && entry.eq_idx != -1) {
+        const DBEntry& eq_entry = this->entry(entry.eq_idx);
+        g = Game(board(entry.eq_idx));
         g.b_computed = g.w_computed = true;
-        g.b_wins = entry.b_wins;
-        g.w_wins = entry.w_wins;
+        g.b_wins = eq_entry.b_wins;
+        g.w_wins = eq_entry.w_wins;
+        return;
     }
-    return;
+    g.b_computed = g.w_computed = true;
+    g.b_wins = entry.b_wins;
+    g.w_wins = entry.w_wins;
+}
+
+const DBEntry& Cache::entry(int64_t idx) const
+{
+    int n = level(idx);
+    assert(m_levels[n].entries);
+    return m_levels[n].entries[idx - m_accum_sizes[n]];
 }
 
-void Cache::compute_outcome(bool store, bool verbose)
+// boards are not stored; they are decoded from their idx
+Board Cache::board(int64_t idx) const
 {
-    for (int i = 1; i < MAX_NUM_EMPTY+1; i++) {
-        std::cout << "\r******* NUM_EMPYT " << i << " *******\n";
-        int total = m_cache_sizes[i];
-
-        std::vector<Board> boards = construct_boards(i, total);
-        assert(total == (int)boards.size());
-        for (int j = 0; j < total; j++) {
-            int hashcode = m_accum_sizes[i] + j;
-            m_cache[hashcode].board = boards[j];
-            assert(m_cache[hashcode].eq_idx == -1);
-            Game game = Game(boards[j]);
-            game.compute();
-            set_outcome(m_cache[hashcode], game.get_outcome());
+    int n = level(idx);
+    return rank_to_board(n, idx - m_accum_sizes[n]);
+}
+
+int Cache::level(int64_t idx) const
+{
+    assert(idx >= 0 && idx < m_accum_sizes[MAX_DB_NUM_EMPTY+1]);
+    int n = 1;
+    while (idx >= m_accum_sizes[n+1])
+        n++;
+    return n;
+}
+
+// Positions of one level only look up lower levels, so levels are built
+// bottom-up, each split in chunks over num_threads threads
+void Cache::compute_outcome(bool verbose, int num_threads)
+{
+    extend_outcomes(MAX_NUM_EMPTY, num_threads, verbose);
+}
+
+// Map the levels up to up_to_num_empty; missing level files are converted
+// from the legacy format or generated from the levels below
+void Cache::extend_outcomes(int up_to_num_empty, int num_threads, bool verbose)
+{
+    assert(up_to_num_empty <= MAX_DB_NUM_EMPTY);
+    for (int n = m_max_num_empty+1; n < up_to_num_empty+1; n++) {
+        if (! map_level(n) && ! (convert_level(n) && map_level(n))) {
+            std::cout << "\r******* NUM_EMPYT " << n << " *******\n";
+            compute_level(n, num_threads);
+            if (! map_level(n)) {
+                std::cerr << "cannot map level " << n << "\n";
+                return;
+            }
             if (verbose) {
-                int outcome = game.get_outcome();
-                std::cout << game << "\t" << outcome_class[outcome+1] << "\n";
+                for (int64_t j = 0; j < m_cache_sizes[n]; j++) {
+                    Board board = rank_to_board(n, j);
+                    std::cout << board << "\t" << outcome_class[get_outcome(m_levels[n].entries[j])+1] << "\n";
+                }
             }
         }
+        m_max_num_empty = n;
+    }
+}
+
+// Solve a level into a shared writable mapping of its file, so the kernel
+// writes finished pages back instead of keeping the level in RAM
+void Cache::compute_level(int num_empty, int num_threads)
+{
+    std::string file_name = "./db/"+std::to_string(num_empty)+".cdb";
+    std::string tmp_name = file_name + ".tmp";
+    int64_t total = m_cache_sizes[num_empty];
+    size_t bytes = total * sizeof(DBEntry);
+
+    int fd = open(tmp_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1 || ftruncate(fd, bytes) != 0) {
+        std::cerr << "cannot create " << tmp_name << "\n";
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+        std::cerr << "cannot map " << tmp_name << "\n";
+        return;
+    }
+    DBEntry* entries = (DBEntry*)ptr;
+
+    parallel_for(total, num_threads, [&](int64_t j) {
+        Game game = Game(rank_to_board(num_empty, j));
+        game.compute();
+        entries[j].eq_idx = -1;
+        set_outcome(entries[j], game.get_outcome());
+    });
+
+    msync(ptr, bytes, MS_SYNC);
+    munmap(ptr, bytes);
+    std::rename(tmp_name.c_str(), file_name.c_str());
+}
 
-        std::printf("\33[2K\r");
+bool Cache::map_level(int num_empty)
+{
+    std::string file_name = "./db/"+std::to_string(num_empty)+".cdb";
+    size_t bytes = m_cache_sizes[num_empty] * sizeof(DBEntry);
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size != bytes) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    // the default levels are hot; larger ones are probed sparsely
+    madvise(ptr, bytes, num_empty > MAX_NUM_EMPTY ? MADV_RANDOM : MADV_WILLNEED);
+
+    m_levels[num_empty].entries = (const DBEntry*)ptr;
+    m_levels[num_empty].size = m_cache_sizes[num_empty];
+    return true;
+}
+
+// record of the legacy ./db/<n>.db format
+struct LegacyDBEntry
+{
+    char outcome;
+    int eq_idx;
+} __attribute__((__packed__));
 
-        if (store)
-            store_line(m_cache+m_accum_sizes[i], total, "./db/"+std::to_string(i)+".db");
+// rewrite a legacy level file as a <n>.cdb file, once
+bool Cache::convert_level(int num_empty)
+{
+    std::string file_name = "./db/"+std::to_string(num_empty);
+    int64_t total = m_cache_sizes[num_empty];
+
+    std::ifstream f;
+    f.open(file_name+".db", std::ios::binary);
+    if (! f)
+        return false;
+    std::vector<LegacyDBEntry> legacy(total);
+    f.read((char*)legacy.data(), total*sizeof(LegacyDBEntry));
+    if (f.gcount() != (std::streamsize)(total*sizeof(LegacyDBEntry)))
+        return false;
+    f.close();
+
+    std::vector<DBEntry> entries(total);
+    for (int64_t i = 0; i < total; i++) {
+        if (legacy[i].eq_idx >= (1 << 29)) {
+            std::cerr << "eq_idx out of range in " << file_name << ".db\n";
+            return false;
+        }
+        entries[i].eq_idx = legacy[i].eq_idx;
+        set_outcome(entries[i], legacy[i].outcome);
     }
+
+    std::ofstream out;
+    out.open(file_name+".cdb.tmp", std::ios::binary);
+    out.write((char*)entries.data(), total*sizeof(DBEntry));
+    out.close();
+    if (! out)
+        return false;
+    return std::rename((file_name+".cdb.tmp").c_str(), (file_name+".cdb").c_str()) == 0;
 }
 
-int Cache::hash_func(Board board) const
+// idx of a board within its level, -1 if the level is not in the DB
+int64_t Cache::rank(const PackedBoard& board, int& num_empty) const
 {
-    int num_empty = 0, hashcode = 0;
+    int64_t hashcode = 0;
+    num_empty = 0;
     Color p = EMPTY;
-    for (Point& point : board) {
+    for (int i = 0; i < board.size; i++) {
+        Point point = board[i];
         num_empty += point == EMPTY;
         if (point == EMPTY && p == EMPTY) {
             hashcode = hashcode * 3 + 0;
@@ -105,55 +248,29 @@ int Cache::hash_func(Board board) const
     if (board[board.size-1] == EMPTY) {
         hashcode *= 3;
     }
-    
-    if (num_empty > MAX_NUM_EMPTY)
+
+    if (num_empty == 0 || num_empty > m_max_num_empty)
         return -1;
-    hashcode += m_accum_sizes[num_empty];
     return hashcode;
 }
 
-struct DBFileEntry
-{
-    char outcome;
-    int eq_idx;
-} __attribute__((__packed__));
-
-
-void Cache::store_outcomes()
+int64_t Cache::hash_func(Board board) const
 {
-    std::string file_name = "./db/";
-    for (int n = 1; n < MAX_NUM_EMPTY+1; n++) {
-        store_line(m_cache+m_accum_sizes[n], m_cache_sizes[n], file_name+std::to_string(n)+".db");
-    }
+    int num_empty;
+    int64_t hashcode = rank(board, num_empty);
+    if (hashcode == -1)
+        return -1;
+    return hashcode + m_accum_sizes[num_empty];
 }
 
 void Cache::load_outcomes(int up_to_num_empty)
 {
+    assert(up_to_num_empty <= MAX_DB_NUM_EMPTY);
     std::cerr << "loading cache...";
-    std::string file_name = "./db/";
-    for (int n = 1; n < up_to_num_empty+1; n++) {
-        std::ifstream f;
-        f.open(file_name+std::to_string(n)+".db", std::ios::binary);
-        if (f) {
-            DBFileEntry* outcomes = (DBFileEntry*) std::malloc(m_cache_sizes[n]*sizeof(DBFileEntry));
-            f.read((char*)outcomes, m_cache_sizes[n]*sizeof(DBFileEntry));
-            f.close();
-
-            std::vector<Board> list = construct_boards(n, m_cache_sizes[n]);
-            for (int i = 0; i < m_cache_sizes[n]; i++) {
-                int hashcode = m_accum_sizes[n] + i;
-                m_cache[hashcode].board = list[i];
-                if (outcomes[i].outcome == N_PSN)
-                    m_cache[hashcode].b_wins = m_cache[hashcode].w_wins = true;
-                else if (outcomes[i].outcome == L_PSN)
-                    m_cache[hashcode].b_wins = true;
-                else if (outcomes[i].outcome == R_PSN)
-                    m_cache[hashcode].w_wins = true;
-                m_cache[hashcode].eq_idx = outcomes[i].eq_idx;
-            }
-
-            std::free(outcomes);
-        }
+    for (int n = m_max_num_empty+1; n < up_to_num_empty+1; n++) {
+        if (! map_level(n) && ! (convert_level(n) && map_level(n)))
+            break;
+        m_max_num_empty = n;
     }
     std::cerr << "complete\n";
 }
@@ -164,12 +281,8 @@ void Cache::load_outcomes(int up_to_num_empty)
 
 void set_outcome(DBEntry& entry, char outcome)
 {
-    if (outcome == N_PSN)
-        entry.b_wins = entry.w_wins = true;
-    else if (outcome == L_PSN)
-        entry.b_wins = true;
-    else if (outcome == R_PSN)
-        entry.w_wins = true;
+    entry.b_wins = outcome == N_PSN || outcome == L_PSN;
+    entry.w_wins = outcome == N_PSN || outcome == R_PSN;
 }
 
 char get_outcome(const DBEntry& entry)
@@ -185,21 +298,6 @@ char get_outcome(const DBEntry& entry)
         return P_PSN;
 }
 
-void store_line(DBEntry* ptr, int size, std::string file_name)
-{   
-    DBFileEntry* outcomes = (DBFileEntry*) std::malloc(size*sizeof(DBFileEntry));
-    for (int i = 0; i < size; i++) {
-        outcomes[i].outcome = get_outcome(ptr[i]);
-        outcomes[i].eq_idx = ptr[i].eq_idx;
-    }
-
-    std::ofstream f;
-    f.open(file_name, std::ios::binary);
-    f.write((char*)outcomes, size*sizeof(DBFileEntry));
-    f.close(); 
-    std::free(outcomes);
-}
-
 const Color placeholder = 3;
 
 std::vector<Board> construct_boards(int num_empty, int total)
@@ -235,6 +333,25 @@ std::vector<Board> construct_boards(int num_empty, int total)
     return list;
 }
 
+// board at a rank within its level; the inverse of Cache::hash_func
+Board rank_to_board(int num_empty, int64_t rank)
+{
+    Color digits[MAX_DB_NUM_EMPTY+1];
+    for (int i = num_empty; i >= 0; i--) {
+        digits[i] = rank % 3;
+        rank /= 3;
+    }
+
+    Board board;
+    for (int i = 0; i < num_empty+1; i++) {
+        if (digits[i] != EMPTY)
+            board.push_back(digits[i]);
+        if (i < num_empty)
+            board.push_back(EMPTY);
+    }
+    return board;
+}
+
 Board remove_placeholder(Board& board)
 {
     Board cboard;
@@ -252,7 +369,7 @@ Board remove_placeholder(Board& board)
 
 void exp_check_incentive(const Cache& cache, int num_empty)
 {
-    Game one(cache[12].board, cache[12].b_wins, cache[12].w_wins);    // .x. = +1
+    Game one(cache.board(12), cache[12].b_wins, cache[12].w_wins);    // .x. = +1
 
     int total = cache.m_accum_sizes[num_empty+1];
     int n = 1;
@@ -261,7 +378,7 @@ void exp_check_incentive(const Cache& cache, int num_empty)
             std::cerr << "******* NUM_EMPYT " << n << " *******\n";
             n++;
         }
-        Game g(cache[i].board, cache[i].b_wins, cache[i].w_wins);
+        Game g(cache.board(i), cache[i].b_wins, cache[i].w_wins);
         std::vector<int> legal_points = g.legal_points(BLACK);
         int size = (int)legal_points.size();
         if (size == 0)
@@ -279,8 +396,8 @@ void exp_check_incentive(const Cache& cache, int num_empty)
                     list.push_back(subgame);
             }
             if (!g.is_zero()) {
-                int hashcode = cache.hash_func(inverse_board(g.m_board));
-                Game inv_g(cache[hashcode].board, cache[hashcode].b_wins, cache[hashcode].w_wins);
+                int64_t hashcode = cache.hash_func(inverse_board(g.get_board()));
+                Game inv_g(cache.board(hashcode), cache[hashcode].b_wins, cache[hashcode].w_wins);
                 list.push_back(inv_g);
             }
             list.push_back(one);  // .x. = +1
@@ -298,3 +415,29 @@ void exp_check_incentive(const Cache& cache, int num_empty)
         }
     }
 }
+
+bool exp_check_legal_mask(const Cache& cache, int num_empty)
+{
+    int total = cache.m_accum_sizes[num_empty+1];
+    for (int i = 0; i < total; i++) {
+        Board board = cache.board(i);
+        Game g(board);
+        PackedBoard packed(board);
+        if (packed.to_board() != board) {
+            std::cout << "packing mismatch: " << g << "\n";
+            return false;
+        }
+
+        uint64_t b_mask, w_mask;
+        packed.legal_masks(b_mask, w_mask);
+        for (int point = 0; point < g.m_board.size; point++) {
+            bool b_legal = (b_mask >> point) & 1;
+            bool w_legal = (w_mask >> point) & 1;
+            if (b_legal != g.is_legal_point(point, BLACK) || w_legal != g.is_legal_point(point, WHITE)) {
+                std::cout << "legal mask mismatch: " << g << " " << point << "\n";
+                return false;
+            }
+        }
+    }
+    return true;
+}
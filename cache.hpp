@@ -7,14 +7,24 @@
 
 #include "game.hpp"
 
-const int MAX_NUM_EMPTY = 15;
+const int MAX_NUM_EMPTY = 15;       // levels built by --generate-db and loaded by default
+const int MAX_DB_NUM_EMPTY = 20;    // levels beyond MAX_NUM_EMPTY are built by --extend-db
 
+// 4-byte DB record; ./db/<n>.cdb is the array of a level's records, mapped in place
 struct DBEntry
 {
-    Board board;
-    bool b_wins = false;
-    bool w_wins = false;
-    int eq_idx = -1;    // idx of the simplest equivalent w.r.t. m_head
+    uint32_t b_wins : 1;
+    uint32_t w_wins : 1;
+    int32_t eq_idx : 30;    // idx of the simplest equivalent w.r.t. m_head, -1 if none
+};
+
+static_assert(sizeof(DBEntry) == 4, "DB records are stored as 32-bit words");
+
+// a mapped level file, paged in on demand
+struct DBLevel
+{
+    const DBEntry* entries = nullptr;
+    int64_t size = 0;
 };
 
 
@@ -24,37 +34,46 @@ public:
     Cache();
     ~Cache();
 
-    DBEntry& operator[](size_t pos) { return m_cache[pos]; }
-    DBEntry operator[](size_t pos) const { return m_cache[pos]; };
-    DBEntry* begin() { return m_cache; };
-    DBEntry* end() { return m_cache + m_accum_sizes[MAX_NUM_EMPTY+1]; }
+    const DBEntry& operator[](int64_t idx) const { return entry(idx); };
 
-    int hash_func(Board board) const;
+    int64_t hash_func(Board board) const;
     void lookup(Game& g, bool equivalent_replace=true) const;
+    const DBEntry& entry(int64_t idx) const;
+    Board board(int64_t idx) const;
 
-    void compute_outcome(bool store=false, bool verbose=false);
+    void compute_outcome(bool verbose=false, int num_threads=1);
+    void extend_outcomes(int up_to_num_empty, int num_threads=1, bool verbose=false);
 
-    void store_outcomes();
     void load_outcomes(int up_to_num_empty);
 
+    int max_num_empty() const { return m_max_num_empty; };
+
 //private:
-    DBEntry* m_cache;
-    int m_cache_sizes[MAX_NUM_EMPTY+1];
-    int m_accum_sizes[MAX_NUM_EMPTY+2];
+    int64_t m_cache_sizes[MAX_DB_NUM_EMPTY+1];
+    int64_t m_accum_sizes[MAX_DB_NUM_EMPTY+2];
+
+    DBLevel m_levels[MAX_DB_NUM_EMPTY+1];
+    int m_max_num_empty = 0;    // levels 1..m_max_num_empty are mapped
+
+    int64_t rank(const PackedBoard& board, int& num_empty) const;
+    int level(int64_t idx) const;
+    bool map_level(int num_empty);
+    bool convert_level(int num_empty);
+    void compute_level(int num_empty, int num_threads);
 };
 
 /*******************************************************/
 /********************* functions ***********************/
 /*******************************************************/
 
-void set_outcome(DBEntry& ptr, char outcome);
-
-char get_outcome(const DBEntry& ptr);
+void set_outcome(DBEntry& entry, char outcome);
 
-void store_line(DBEntry* ptr, int size, std::string file_name);
+char get_outcome(const DBEntry& entry);
 
 std::vector<Board> construct_boards(int num_empty, int total);
 
+Board rank_to_board(int num_empty, int64_t rank);
+
 Board remove_placeholder(Board& board);
 
 /*******************************************************/
@@ -66,5 +85,8 @@ Board remove_placeholder(Board& board);
 /* Check if there exists a non-eye-filling move that g -> g' where g' <= g - 1 */
 void exp_check_incentive(const Cache& cache, int num_empty);
 
+/* Check that PackedBoard::legal_mask agrees with Game::is_legal_point for both colors */
+bool exp_check_legal_mask(const Cache& cache, int num_empty);
+
 
 #endif
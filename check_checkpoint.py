@@ -0,0 +1,53 @@
+import os
+import subprocess
+import sys
+import tempfile
+
+# solves stopped by a node budget and resumed from their checkpoint must give
+# the result of a fresh solve, also when the resumed sum lists its
+# components in another order (the refuted root moves are kept per root)
+COMMAND = ['./solver_main', '--batch', '--pair-db', '0']
+BUDGET = '20000'
+CASES = [
+    # (components of the stopped solve, components of the resumed solve, toplay)
+    (['.........o..', '.......'], ['.........o..', '.......'], 'b'),
+    (['.........o..', '.......'], ['.......', '.........o..'], 'b'),
+]
+
+
+def solve(boards, toplay, options):
+    query = ' '.join(boards) + ' ' + toplay + '\n'
+    proc = subprocess.run(COMMAND + options, input=query, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if proc.returncode:
+        print(proc.stderr)
+        return None
+    return proc.stdout.split('\t')[0]
+
+
+def main():
+    failures = 0
+    with tempfile.TemporaryDirectory() as tmp:
+        path = os.path.join(tmp, 'check.ckp')
+        for first, second, toplay in CASES:
+            name = ' '.join(first) + ' ' + toplay + ' -> ' + ' '.join(second) + ' ' + toplay
+            if os.path.exists(path):
+                os.remove(path)
+            stopped = solve(first, toplay, ['--max-nodes', BUDGET, '--checkpoint', path])
+            resumed = solve(second, toplay, ['--checkpoint', path])
+            fresh = solve(second, toplay, [])
+            if stopped != 'unknown':
+                print(name + "\tnot stopped by the budget (" + str(stopped) + ")")
+                failures += 1
+            elif resumed is None or resumed != fresh:
+                print(name + "\tFAILED: resumed " + str(resumed) + ", fresh " + str(fresh))
+                failures += 1
+            else:
+                print(name + "\t" + resumed)
+
+    if failures:
+        print("%d checkpoint cases failed" % failures)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
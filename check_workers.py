@@ -0,0 +1,47 @@
+import subprocess
+import sys
+
+# solves on worker processes must give the result of a single-process
+# solve, and a node budget must bound the whole coordinated solve
+COMMAND = ['./solver_main', '--batch', '--pair-db', '0']
+WORKERS = ['--workers', '2', '--split-depth', '2']
+CASES = [
+    # (components, toplay, options, expected result or None for that of a single process);
+    # the components are beyond the DB levels, or their sum is, so the workers search
+    (['.x..................'], 'b', [], None),
+    (['.x..................'], 'w', [], None),
+    (['.........o..', '.......'], 'b', [], None),
+    (['.........o..', '.......'], 'w', [], None),
+    (['.........o..', '.......'], 'b', ['--max-nodes', '1000'], 'unknown'),
+]
+
+
+def solve(boards, toplay, options):
+    query = ' '.join(boards) + ' ' + toplay + '\n'
+    proc = subprocess.run(COMMAND + options, input=query, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if proc.returncode:
+        print(proc.stderr)
+        return None
+    return proc.stdout.split('\t')[0]
+
+
+def main():
+    failures = 0
+    for boards, toplay, options, expected in CASES:
+        name = ' '.join(boards + [toplay] + options)
+        if expected is None:
+            expected = solve(boards, toplay, options)
+        result = solve(boards, toplay, WORKERS + options)
+        if result is None or result != expected:
+            print(name + "\tFAILED: workers " + str(result) + ", expected " + str(expected))
+            failures += 1
+        else:
+            print(name + "\t" + result)
+
+    if failures:
+        print("%d worker cases failed" % failures)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,199 @@
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+#include "checkpoint.hpp"
+
+// file layout, little-endian:
+//   "NOGOCKP2", root key, # of refuted root moves, (black, white, size, point)
+//   records of 8+8+4+4 bytes, # of entries, (hashcode, info) records of 8+2 bytes;
+//   no entries for a table mapped from a file, which holds them already
+const char CHECKPOINT_MAGIC[8] = {'N', 'O', 'G', 'O', 'C', 'K', 'P', '2'};
+const int RECORD_SIZE = 10;
+const int WRITE_BUFFER_RECORDS = 1 << 16;
+
+/////////////////////// RootProgress ///////////////////////
+
+void RootProgress::start(uint64_t root_key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (root_key != m_root_key)
+        m_refuted.clear();
+    m_root_key = root_key;
+}
+
+void RootProgress::refute(const Game& component, int point)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (! is_refuted_locked(component.m_board, point))
+        m_refuted.push_back(RootMove{component.m_board, point});
+}
+
+bool RootProgress::is_refuted(const Game& component, int point) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return is_refuted_locked(component.m_board, point);
+}
+
+// equal components give equal positions after the same move, so a move
+// refuted in one copy is refuted in all
+bool RootProgress::is_refuted_locked(const PackedBoard& board, int point) const
+{
+    for (const RootMove& m : m_refuted) {
+        if (m.point == point && m.board == board)
+            return true;
+    }
+    return false;
+}
+
+int RootProgress::num_refuted() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return (int)m_refuted.size();
+}
+
+/////////////////////// files ///////////////////////
+
+bool save_checkpoint(const std::string& path, ZobristHash& tt, const RootProgress& progress)
+{
+    std::ofstream out(path + ".tmp", std::ios::binary);
+    if (! out)
+        return false;
+
+    uint64_t root_key;
+    std::vector<RootMove> refuted;
+    {
+        std::lock_guard<std::mutex> lock(progress.m_mutex);
+        root_key = progress.m_root_key;
+        refuted = progress.m_refuted;
+    }
+    uint64_t num_refuted = refuted.size();
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    out.write((const char*)&root_key, sizeof(root_key));
+    out.write((const char*)&num_refuted, sizeof(num_refuted));
+    for (const RootMove& move : refuted) {
+        int32_t size_point[2] = {move.board.size, move.point};
+        out.write((const char*)&move.board.black, sizeof(move.board.black));
+        out.write((const char*)&move.board.white, sizeof(move.board.white));
+        out.write((const char*)size_point, sizeof(size_point));
+    }
+
+    // the count is only known after the scan; patched in at the end
+    std::streampos count_pos = out.tellp();
+    uint64_t num_entries = 0;
+    out.write((const char*)&num_entries, sizeof(num_entries));
+
+    // a mapped table is in its file already; only the root moves are saved
+    if (! tt.is_mapped()) {
+        std::vector<char> buffer;
+        buffer.reserve(WRITE_BUFFER_RECORDS * RECORD_SIZE);
+        tt.for_each([&](uint64_t hashcode, uint16_t info) {
+            char record[RECORD_SIZE];
+            std::memcpy(record, &hashcode, sizeof(hashcode));
+            std::memcpy(record + sizeof(hashcode), &info, sizeof(info));
+            buffer.insert(buffer.end(), record, record + RECORD_SIZE);
+            num_entries++;
+            if (buffer.size() == buffer.capacity()) {
+                out.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        });
+        out.write(buffer.data(), buffer.size());
+    }
+    out.seekp(count_pos);
+    out.write((const char*)&num_entries, sizeof(num_entries));
+    out.close();
+    if (! out)
+        return false;
+    return std::rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+bool load_checkpoint(const std::string& path, ZobristHash& tt, RootProgress& progress)
+{
+    std::ifstream in(path, std::ios::binary);
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    if (! in.read(magic, sizeof(magic)) || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0)
+        return false;
+
+    uint64_t root_key, num_refuted;
+    in.read((char*)&root_key, sizeof(root_key));
+    in.read((char*)&num_refuted, sizeof(num_refuted));
+    std::vector<RootMove> refuted;
+    for (uint64_t i = 0; i < num_refuted && in; i++) {
+        RootMove move;
+        int32_t size_point[2];
+        in.read((char*)&move.board.black, sizeof(move.board.black));
+        in.read((char*)&move.board.white, sizeof(move.board.white));
+        in.read((char*)size_point, sizeof(size_point));
+        move.board.size = size_point[0];
+        move.point = size_point[1];
+        refuted.push_back(move);
+    }
+
+    uint64_t num_entries;
+    if (! in.read((char*)&num_entries, sizeof(num_entries)))
+        return false;
+    std::vector<char> buffer(WRITE_BUFFER_RECORDS * RECORD_SIZE);
+    while (num_entries > 0) {
+        uint64_t count = std::min(num_entries, (uint64_t)WRITE_BUFFER_RECORDS);
+        if (! in.read(buffer.data(), count * RECORD_SIZE))
+            return false;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t hashcode;
+            uint16_t info;
+            std::memcpy(&hashcode, &buffer[i * RECORD_SIZE], sizeof(hashcode));
+            std::memcpy(&info, &buffer[i * RECORD_SIZE + sizeof(hashcode)], sizeof(info));
+            tt.restore(hashcode, info);
+        }
+        num_entries -= count;
+    }
+
+    std::lock_guard<std::mutex> lock(progress.m_mutex);
+    progress.m_root_key = root_key;
+    progress.m_refuted = refuted;
+    return true;
+}
+
+/////////////////////// checkpointer ///////////////////////
+
+static std::thread checkpointer;
+static std::atomic<bool> checkpointer_stop(false);
+
+void start_checkpointer(const std::string& path, double interval, ZobristHash& tt, const RootProgress& progress)
+{
+    stop_checkpointer();
+    checkpointer_stop = false;
+    checkpointer = std::thread([path, interval, &tt, &progress]() {
+        typedef std::chrono::steady_clock Clock;
+        const auto POLL = std::chrono::milliseconds(100);
+        auto period = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+        auto next = Clock::now() + period;
+        while (! checkpointer_stop.load()) {
+            std::this_thread::sleep_for(POLL);
+            if (Clock::now() < next)
+                continue;
+            auto beg = Clock::now();
+            if (save_checkpoint(path, tt, progress)) {
+                double seconds = std::chrono::duration<double>(Clock::now() - beg).count();
+                std::cerr << "checkpoint " << path << " (" << tt.size() << " entries, "
+                          << progress.num_refuted() << " refuted root moves, " << seconds << "s)\n";
+            }
+            else {
+                std::cerr << "cannot write checkpoint " << path << "\n";
+            }
+            next = Clock::now() + period;
+        }
+    });
+}
+
+void stop_checkpointer()
+{
+    if (checkpointer.joinable()) {
+        checkpointer_stop = true;
+        checkpointer.join();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "sumgame.hpp"
+#include "zobrist_hash.hpp"
+
+// Checkpoints of long solves: a sparse snapshot of the occupied entries of
+// the transposition table, and the root moves already refuted. TT results
+// are exact whatever the root, so a snapshot is valid for any later solve;
+// refuted moves only carry over to a solve of the same root position.
+
+// a root move, told apart by the exact board of its component: subgame
+// indices depend on the order the components were given in, and the root
+// key does not
+struct RootMove
+{
+    PackedBoard board;
+    int point;
+};
+
+// refuted root moves of the current solve, shared by the search threads
+// and the checkpoint thread
+class RootProgress
+{
+public:
+    void start(uint64_t root_key);    // keeps the refuted moves of the same root
+
+    void refute(const Game& component, int point);
+    bool is_refuted(const Game& component, int point) const;
+    int num_refuted() const;
+
+private:
+    friend bool save_checkpoint(const std::string& path, ZobristHash& tt, const RootProgress& progress);
+    friend bool load_checkpoint(const std::string& path, ZobristHash& tt, RootProgress& progress);
+
+    bool is_refuted_locked(const PackedBoard& board, int point) const;
+
+    mutable std::mutex m_mutex;
+    uint64_t m_root_key = 0;
+    std::vector<RootMove> m_refuted;
+};
+
+/* written to path.tmp, then renamed over path; the entries of a table
+   mapped from a file are left out, the file holds them already */
+bool save_checkpoint(const std::string& path, ZobristHash& tt, const RootProgress& progress);
+
+/* entries are inserted into tt, whatever its size; false if path is not a checkpoint */
+bool load_checkpoint(const std::string& path, ZobristHash& tt, RootProgress& progress);
+
+/* saves a checkpoint every interval seconds from a background thread;
+   the search goes on while the table is scanned */
+void start_checkpointer(const std::string& path, double interval, ZobristHash& tt, const RootProgress& progress);
+void stop_checkpointer();
+
+#endif
@@ -0,0 +1,328 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "coordinator.hpp"
+#include "move_ordering.hpp"
+
+/////////////////////// Coordinator ///////////////////////
+
+Coordinator::Coordinator(const std::string& worker_cmd, int num_workers, int split_depth) :
+    m_worker_cmd(worker_cmd), m_num_workers(num_workers), m_split_depth(split_depth)
+{ }
+
+Coordinator::~Coordinator()
+{
+    for (Worker& worker : m_workers) {
+        stop(worker);
+    }
+}
+
+bool Coordinator::start()
+{
+    // a dead worker must not take the coordinator down with it
+    signal(SIGPIPE, SIG_IGN);
+    std::string command = "exec " + m_worker_cmd;
+    for (int i = 0; i < m_num_workers; i++) {
+        // the coordinator's ends are close-on-exec, so later workers do
+        // not inherit them and every worker sees EOF once its stdin closes
+        int to_worker[2], from_worker[2];
+        if (pipe2(to_worker, O_CLOEXEC) != 0)
+            break;
+        if (pipe2(from_worker, O_CLOEXEC) != 0) {
+            close(to_worker[0]);
+            close(to_worker[1]);
+            break;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(to_worker[0], STDIN_FILENO);
+            dup2(from_worker[1], STDOUT_FILENO);
+            execl("/bin/sh", "sh", "-c", command.c_str(), (char*)nullptr);
+            _exit(127);
+        }
+        close(to_worker[0]);
+        close(from_worker[1]);
+        if (pid < 0) {
+            close(to_worker[1]);
+            close(from_worker[0]);
+            break;
+        }
+        Worker worker;
+        worker.pid = pid;
+        worker.in = to_worker[1];
+        worker.out = from_worker[0];
+        m_workers.push_back(worker);
+    }
+    return ! m_workers.empty();
+}
+
+void Coordinator::stop(Worker& worker)
+{
+    if (worker.pid == -1)
+        return;
+    close(worker.in);
+    close(worker.out);
+    // an idle worker exits at EOF; a busy one would finish a query nobody waits for
+    if (worker.busy)
+        kill(worker.pid, SIGTERM);
+    waitpid(worker.pid, nullptr, 0);
+    worker.pid = -1;
+}
+
+int Coordinator::solve(const std::vector<Game>& games, Color toplay, uint64_t& nodes,
+                       const SearchBudget& budget)
+{
+    auto deadline = std::chrono::steady_clock::now()
+        + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(budget.max_seconds));
+
+    m_nodes.clear();
+    m_groups.clear();
+    m_group_of.clear();
+    for (Worker& worker : m_workers) {
+        worker.group = -1;    // answers of an earlier solve are dropped
+    }
+
+    std::vector<Game> subgames = games;
+    SumGame sum(subgames);
+    sum.set_toplay(toplay);
+    std::vector<std::pair<int, int>> known;
+    expand(sum, -1, 0, known);
+    for (auto& [node, outcome] : known) {
+        resolve(node, outcome);
+    }
+    std::cerr << "frontier of " << m_groups.size() << " positions at depth " << m_split_depth << "\n";
+
+    // the first move at every leaf's parent before the second move at any:
+    // one refutation usually settles a node, so the siblings of a leaf are
+    // the work most likely to be wasted
+    std::vector<std::vector<int>> ranks(m_groups.size());
+    for (int g = 0; g < (int)m_groups.size(); g++) {
+        for (int node = m_groups[g].leaves[0]; m_nodes[node].parent != -1; node = m_nodes[node].parent) {
+            ranks[g].push_back(m_nodes[node].rank);
+        }
+    }
+    std::deque<int> queue;
+    for (int g = 0; g < (int)m_groups.size(); g++) {
+        queue.push_back(g);
+    }
+    std::stable_sort(queue.begin(), queue.end(), [&ranks](int a, int b) {
+        return ranks[a] < ranks[b];
+    });
+    // rank of the root move above each group
+    std::vector<int> subtree(m_groups.size());
+    for (int g = 0; g < (int)m_groups.size(); g++) {
+        subtree[g] = ranks[g].empty() ? -1 : ranks[g].back();
+    }
+
+    nodes = 0;
+    while (m_nodes[0].outcome == -1) {
+        // queries still in flight are left to finish; the next solve drops their answers
+        if (budget.max_nodes > 0 && nodes >= budget.max_nodes)
+            break;
+        int timeout = -1;
+        if (budget.max_seconds > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+            if (left.count() <= 0)
+                break;
+            timeout = (int)std::min<int64_t>(left.count(), INT_MAX);
+        }
+
+        bool in_flight = false;
+        for (Worker& worker : m_workers) {
+            if (worker.pid == -1)
+                continue;
+            while (! worker.busy && ! queue.empty()) {
+                // rather under the root move the worker searched last, whose
+                // positions are in its TT already
+                auto it = std::find_if(queue.begin(), queue.end(), [&](int g) {
+                    return subtree[g] == worker.subtree && is_needed(m_groups[g]);
+                });
+                if (it == queue.end())
+                    it = queue.begin();
+                int group = *it;
+                queue.erase(it);
+                if (! is_needed(m_groups[group]))
+                    continue;
+                if (send(worker, group))
+                    worker.subtree = subtree[group];
+                else
+                    queue.push_front(group);
+            }
+            in_flight |= worker.busy;
+        }
+        if (! in_flight)
+            break;    // nothing left that could solve the root
+
+        std::vector<pollfd> fds;
+        std::vector<Worker*> polled;
+        for (Worker& worker : m_workers) {
+            if (worker.pid != -1 && worker.busy) {
+                fds.push_back(pollfd{worker.out, POLLIN, 0});
+                polled.push_back(&worker);
+            }
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (size_t i = 0; i < fds.size(); i++) {
+            if (fds[i].revents == 0)
+                continue;
+            Worker& worker = *polled[i];
+            char buffer[4096];
+            ssize_t count = read(worker.out, buffer, sizeof(buffer));
+            if (count <= 0) {
+                std::cerr << "worker " << worker.pid << " exited\n";
+                if (worker.group != -1)
+                    queue.push_front(worker.group);
+                worker.busy = false;
+                stop(worker);
+                continue;
+            }
+            worker.pending.append(buffer, count);
+
+            // one answer per query: "1<TAB>ms<TAB>N nodes", "0...", "unknown..." or "error..."
+            size_t pos;
+            while (worker.busy && (pos = worker.pending.find('\n')) != std::string::npos) {
+                std::string answer = worker.pending.substr(0, pos);
+                worker.pending.erase(0, pos + 1);
+                worker.busy = false;
+                int group = worker.group;
+                worker.group = -1;
+                if (group == -1)
+                    continue;
+
+                size_t tab = answer.find('\t');
+                std::string outcome = answer.substr(0, tab);
+                if (tab != std::string::npos) {
+                    size_t nodes_pos = answer.find('\t', tab + 1);
+                    if (nodes_pos != std::string::npos)
+                        nodes += std::strtoull(answer.c_str() + nodes_pos + 1, nullptr, 10);
+                }
+                if (outcome == "1" || outcome == "0") {
+                    for (int leaf : m_groups[group].leaves) {
+                        resolve(leaf, outcome == "1");
+                    }
+                }
+                else if (outcome != "unknown") {
+                    std::cerr << "worker " << worker.pid << ": " << answer << "\n";
+                }
+            }
+        }
+    }
+    return m_nodes[0].outcome;
+}
+
+void Coordinator::expand(SumGame& sum, int parent, int depth, std::vector<std::pair<int, int>>& known)
+{
+    int node = (int)m_nodes.size();
+    int rank = parent != -1 ? m_nodes[parent].unresolved++ : 0;
+    m_nodes.push_back(Node{parent, rank, 0, -1, -1});
+
+    bool toplay_win = false;
+    if (sum.static_winner(toplay_win)) {
+        known.emplace_back(node, toplay_win);
+        return;
+    }
+
+    if (depth == m_split_depth) {
+        // sorted, so that transpositions of the frontier share a single query
+        std::vector<std::string> boards;
+        for (const Game& g : sum.m_subgames) {
+            if (g.is_active())
+                boards.push_back(board_to_string(g.get_board()));
+        }
+        std::sort(boards.begin(), boards.end());
+        std::string query;
+        for (const std::string& board : boards) {
+            query += board + " ";
+        }
+        query += sum.m_toplay == BLACK ? "b" : "w";
+
+        auto it = m_group_of.find(query);
+        if (it == m_group_of.end()) {
+            it = m_group_of.emplace(query, (int)m_groups.size()).first;
+            m_groups.push_back(Group{query, {}});
+        }
+        m_nodes[node].group = it->second;
+        m_groups[it->second].leaves.push_back(node);
+        return;
+    }
+
+    std::vector<Move> moves;
+    default_move_ordering().order(sum, depth, 0, moves);
+    if (moves.empty()) {
+        known.emplace_back(node, 0);
+        return;
+    }
+    for (const Move& move : moves) {
+        sum.play(move.subgame, move.point);
+        sum.m_toplay = opp_color(sum.m_toplay);
+        expand(sum, node, depth + 1, known);
+        sum.undo();
+        sum.m_toplay = opp_color(sum.m_toplay);
+    }
+}
+
+// a child that loses makes its parent a win; the parent loses once all children win
+void Coordinator::resolve(int node, int outcome)
+{
+    if (m_nodes[node].outcome != -1)
+        return;
+    m_nodes[node].outcome = outcome;
+    int parent = m_nodes[node].parent;
+    if (parent == -1)
+        return;
+    if (outcome == 0)
+        resolve(parent, 1);
+    else if (--m_nodes[parent].unresolved == 0)
+        resolve(parent, 0);
+}
+
+// some leaf of the group still has no ancestor with an outcome
+bool Coordinator::is_needed(const Group& group) const
+{
+    for (int leaf : group.leaves) {
+        bool needed = true;
+        for (int node = leaf; node != -1; node = m_nodes[node].parent) {
+            if (m_nodes[node].outcome != -1) {
+                needed = false;
+                break;
+            }
+        }
+        if (needed)
+            return true;
+    }
+    return false;
+}
+
+bool Coordinator::send(Worker& worker, int group)
+{
+    std::string line = m_groups[group].query + "\n";
+    size_t done = 0;
+    while (done < line.size()) {
+        ssize_t count = write(worker.in, line.data() + done, line.size() - done);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0) {
+            std::cerr << "worker " << worker.pid << " exited\n";
+            stop(worker);
+            return false;
+        }
+        done += count;
+    }
+    worker.busy = true;
+    worker.group = group;
+    return true;
+}
@@ -0,0 +1,85 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+#include "sumgame.hpp"
+
+// Solves a sum on worker processes. The coordinator expands the root to a
+// frontier of positions split_depth plies deep and queues them; each
+// worker is a `solver_main --batch` process with its own DB and TT, given
+// one frontier position at a time as a batch query over its stdin and
+// stdout. Results are combined up the tree as they come back, and the
+// positions whose result no longer matters are never sent.
+//
+// Workers are started with `sh -c "exec <worker_cmd>"`, so a worker may
+// as well be `ssh host solver_main --batch`.
+class Coordinator
+{
+public:
+    Coordinator(const std::string& worker_cmd, int num_workers, int split_depth);
+    ~Coordinator();    // closes the workers' stdin, stops and reaps them
+
+    Coordinator(const Coordinator&) = delete;
+    Coordinator& operator=(const Coordinator&) = delete;
+
+    bool start();    // false if no worker could be started
+
+    /* 1 for a win of toplay, 0 for a loss, -1 if the workers left the
+       root unsolved (a worker budget ran out, or all workers died) or the
+       budget of the whole solve ran out; its nodes are those the workers
+       report, so a query in flight is counted when it is answered */
+    int solve(const std::vector<Game>& games, Color toplay, uint64_t& nodes,
+              const SearchBudget& budget=SearchBudget());
+
+private:
+    struct Worker
+    {
+        pid_t pid = -1;
+        int in = -1;          // the worker's stdin
+        int out = -1;         // the worker's stdout
+        std::string pending;  // output read but not yet a whole line
+        bool busy = false;
+        int group = -1;       // frontier group of the query in flight; -1 if stale
+        int subtree = -1;     // root move above the last query sent
+    };
+
+    // a node of the expanded tree; outcome is for the player to move there
+    struct Node
+    {
+        int parent;
+        int rank;          // among the children of parent, in move order
+        int unresolved;    // # of children without an outcome
+        int outcome;       // 1, 0 or -1 if unknown
+        int group;         // for frontier leaves; -1 otherwise
+    };
+
+    // frontier leaves of the same position, solved once
+    struct Group
+    {
+        std::string query;
+        std::vector<int> leaves;
+    };
+
+    std::string m_worker_cmd;
+    int m_num_workers;
+    int m_split_depth;
+    std::vector<Worker> m_workers;
+
+    std::vector<Node> m_nodes;
+    std::vector<Group> m_groups;
+    std::unordered_map<std::string, int> m_group_of;    // query -> index into m_groups
+
+    // known: (node, outcome) of the leaves solved statically
+    void expand(SumGame& sum, int parent, int depth, std::vector<std::pair<int, int>>& known);
+    void resolve(int node, int outcome);
+    bool is_needed(const Group& group) const;
+    bool send(Worker& worker, int group);
+    void stop(Worker& worker);
+};
+
+#endif
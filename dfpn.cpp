@@ -0,0 +1,219 @@
+#include <iostream>
+
+#include "dfpn.hpp"
+#include "zobrist_hash.hpp"
+#include "search_stats.hpp"
+
+extern ZobristHash hash;
+
+const uint64_t WHITE_KEY = 0x9e3779b97f4a7c15;    // tells apart the two players to move
+
+const int DFPN_BUCKET_SIZE = BUCKET_SIZE / 2;    // entries per bucket
+
+// sum of proof numbers; only a sum with an infinite term is infinite
+inline uint32_t pn_add(uint32_t a, uint32_t b)
+{
+    if (a == PN_INF || b == PN_INF)
+        return PN_INF;
+    return (uint32_t)std::min((uint64_t)a + b, (uint64_t)PN_INF - 1);
+}
+
+/////////////////////// DfpnTable ///////////////////////
+
+bool DfpnTable::resize(uint64_t megabytes)
+{
+    uint64_t num_buckets = buckets_within(megabytes);
+    if (! m_pool.allocate(num_buckets * BUCKET_SIZE)) {
+        m_num_buckets = 0;
+        return false;
+    }
+    m_num_buckets = num_buckets;
+    return true;
+}
+
+bool DfpnTable::lookup(uint64_t key, uint32_t& pn, uint32_t& dn)
+{
+    assert(m_num_buckets > 0);
+    key |= key == 0;    // 0 marks an empty slot
+    AtomicEntry* bucket = m_pool.bucket(key & (m_num_buckets - 1));
+    for (int i = 0; i < DFPN_BUCKET_SIZE; i++) {
+        Entry k = bucket[2*i].load(std::memory_order_relaxed);
+        if (k == 0)
+            return false;
+        if (k == key) {
+            Entry numbers = bucket[2*i+1].load(std::memory_order_relaxed);
+            pn = (uint32_t)numbers;
+            dn = (uint32_t)(numbers >> 32);
+            return true;
+        }
+    }
+    return false;
+}
+
+void DfpnTable::store(uint64_t key, uint32_t pn, uint32_t dn)
+{
+    assert(m_num_buckets > 0);
+    key |= key == 0;
+    AtomicEntry* bucket = m_pool.bucket(key & (m_num_buckets - 1));
+
+    // replace the entry with the smallest numbers, the cheapest to recompute
+    int slot = 0;
+    uint64_t min_numbers = (uint64_t)-1;
+    for (int i = 0; i < DFPN_BUCKET_SIZE; i++) {
+        Entry k = bucket[2*i].load(std::memory_order_relaxed);
+        if (k == 0 || k == key) {
+            slot = i;
+            break;
+        }
+        Entry numbers = bucket[2*i+1].load(std::memory_order_relaxed);
+        uint64_t sum = (numbers & 0xffffffff) + (numbers >> 32);
+        if (sum < min_numbers) {
+            slot = i;
+            min_numbers = sum;
+        }
+    }
+    bucket[2*slot].store(key, std::memory_order_relaxed);
+    bucket[2*slot+1].store((Entry)dn << 32 | pn, std::memory_order_relaxed);
+}
+
+/////////////////////// DfpnGame ///////////////////////
+
+bool DfpnGame::solve()
+{
+    uint32_t pn, dn;
+    mid(PN_INF, PN_INF, pn, dn);
+    assert(pn == 0 || dn == 0);
+    return pn == 0;
+}
+
+void DfpnGame::mid(uint32_t thpn, uint32_t thdn, uint32_t& pn, uint32_t& dn)
+{
+    Color color;
+    uint64_t hashcode = tt_key(color);
+    if (lookup(hashcode, color, pn, dn) && (pn == 0 || dn == 0))
+        return;
+
+    uint64_t start_nodes = m_nodes++;
+    STATS_INC(STAT_NODES);
+    bool toplay_win = false;
+    if (static_winner(toplay_win)) {
+        STATS_INC(STAT_STATIC_CUTOFFS);
+        pn = toplay_win ? 0 : PN_INF;
+        dn = toplay_win ? PN_INF : 0;
+        store(hashcode, color, pn, dn);
+        return;
+    }
+
+    // expand; children are evaluated statically or seeded from their subgames
+    std::vector<Child> children;
+    std::vector<int> subgames;
+    for (int k = sort_active_games(m_subgames, subgames)-1; k >= 0; k--) {
+        uint64_t legal_points = m_subgames[subgames[k]].legal_mask(m_toplay);
+        int size = __builtin_popcountll(legal_points);
+        for (int i = 0; i < size; i++) {
+            int point = select_bit(legal_points, (size-i) / 2);
+            legal_points &= ~((uint64_t)1 << point);
+
+            play(subgames[k], point);
+            m_toplay = opp_color(m_toplay);
+
+            Child child{subgames[k], point, 0, EMPTY, 1, 1};
+            child.hashcode = tt_key(child.color);
+            bool child_win = false;
+            if (! lookup(child.hashcode, child.color, child.pn, child.dn)) {
+                if (static_winner(child_win)) {
+                    STATS_INC(STAT_STATIC_CUTOFFS);
+                    child.pn = child_win ? 0 : PN_INF;
+                    child.dn = child_win ? PN_INF : 0;
+                    store(child.hashcode, child.color, child.pn, child.dn);
+                }
+                else {
+                    initial_numbers(child.pn, child.dn);
+                }
+            }
+
+            undo();
+            m_toplay = opp_color(m_toplay);
+            children.push_back(child);
+        }
+    }
+
+    if (children.empty()) {
+        pn = PN_INF;
+        dn = 0;
+        store(hashcode, color, pn, dn);
+        return;
+    }
+
+    int size = (int)children.size();
+    for (;;) {
+        // pn = min of children dn, dn = sum of children pn
+        int best = 0;
+        uint32_t second_dn = PN_INF;
+        pn = PN_INF;
+        dn = 0;
+        for (int i = 0; i < size; i++) {
+            Child& child = children[i];
+            lookup(child.hashcode, child.color, child.pn, child.dn);
+            if (child.dn < pn) {
+                second_dn = pn;
+                pn = child.dn;
+                best = i;
+            }
+            else if (child.dn < second_dn) {
+                second_dn = child.dn;
+            }
+            dn = pn_add(dn, child.pn);
+        }
+
+        if (pn >= thpn || dn >= thdn)
+            break;
+
+        Child& child = children[best];
+        uint32_t child_thpn = thdn == PN_INF ? PN_INF : pn_add(thdn - dn, child.pn);
+        // 1+epsilon trick: stay in the child until it is clearly worse than the second best
+        uint32_t child_thdn = std::min(thpn, pn_add(second_dn, second_dn / 4 + 1));
+
+        play(child.subgame, child.point);
+        m_toplay = opp_color(m_toplay);
+        mid(child_thpn, child_thdn, child.pn, child.dn);
+        undo();
+        m_toplay = opp_color(m_toplay);
+    }
+
+    store(hashcode, color, pn, dn, m_nodes - start_nodes);
+}
+
+// exact numbers from the ZobristHash, or estimates from the DfpnTable
+bool DfpnGame::lookup(uint64_t hashcode, Color color, uint32_t& pn, uint32_t& dn)
+{
+    int value = hash.get(hashcode, color);
+    if (value != -1) {
+        pn = value ? 0 : PN_INF;
+        dn = value ? PN_INF : 0;
+        return true;
+    }
+    return m_table.lookup(hashcode ^ (color == WHITE ? WHITE_KEY : 0), pn, dn);
+}
+
+void DfpnGame::store(uint64_t hashcode, Color color, uint32_t pn, uint32_t dn, uint64_t subtree_size)
+{
+    if (pn == 0 || dn == 0)
+        hash.insert(hashcode, pn == 0, color, subtree_size);
+    else
+        m_table.store(hashcode ^ (color == WHITE ? WHITE_KEY : 0), pn, dn);
+}
+
+// seed an unsolved position from its subgames: those resolved by the DB
+// cost nothing more, each unknown one makes both a proof and a disproof harder
+void DfpnGame::initial_numbers(uint32_t& pn, uint32_t& dn)
+{
+    uint32_t unknown = 0;
+    for (auto& g : m_subgames) {
+        if (g.is_active() && ! g.is_computed()) {
+            unknown++;
+        }
+    }
+    pn = 1 + unknown;
+    dn = 1 + unknown;
+}
@@ -0,0 +1,58 @@
+#ifndef DFPN_H
+#define DFPN_H
+
+#include "sumgame.hpp"
+#include "utils/hash_map.hpp"
+
+const uint32_t PN_INF = (uint32_t)-1;
+
+// Proof and disproof numbers of unsolved positions. Solved positions are
+// kept in the shared ZobristHash instead, so a key collision here can only
+// misguide the search, never change its result.
+//
+// entry layout: two words per entry, [key] [dn << 32 | pn]; 4 entries per bucket
+class DfpnTable
+{
+public:
+    DfpnTable() { };
+    DfpnTable(uint64_t megabytes) { resize(megabytes); };
+
+    bool resize(uint64_t megabytes);    // reallocate an empty table
+    bool ok() const { return m_num_buckets > 0; };
+
+    bool lookup(uint64_t key, uint32_t& pn, uint32_t& dn);
+    void store(uint64_t key, uint32_t pn, uint32_t dn);
+
+private:
+    uint64_t m_num_buckets = 0;
+    HashMap m_pool;
+};
+
+// depth-first proof-number search (Nagai's MID) over a sum game; table
+// must be ok(), and may be kept across solves like the shared ZobristHash
+class DfpnGame : public SumGame
+{
+public:
+    DfpnGame(std::vector<Game>& games, DfpnTable& table) : SumGame(games), m_table(table) { };
+
+    bool solve();
+
+private:
+    struct Child
+    {
+        int subgame;
+        int point;
+        uint64_t hashcode;    // tt_key of the child
+        Color color;
+        uint32_t pn, dn;    // current numbers, for the opponent to move
+    };
+
+    DfpnTable& m_table;
+
+    void mid(uint32_t thpn, uint32_t thdn, uint32_t& pn, uint32_t& dn);
+    bool lookup(uint64_t hashcode, Color color, uint32_t& pn, uint32_t& dn);
+    void store(uint64_t hashcode, Color color, uint32_t pn, uint32_t dn, uint64_t subtree_size=1);
+    void initial_numbers(uint32_t& pn, uint32_t& dn);
+};
+
+#endif
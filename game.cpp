@@ -3,6 +3,7 @@
 
 #include "game.hpp"
 #include "sumgame.hpp"
+#include "zobrist_hash.hpp"
 
 std::vector<int> Game::emtpy_points() const
 {
@@ -70,7 +71,12 @@ void Game::compute()
 {
     assert(! b_computed);
     assert(! w_computed);
-    SumGame sumgame(*this);
+    ZobristHash& tt = generation_tt();
+
+    // both colors in one table: the entries of a position hold both results,
+    // so the second search reuses what the first one solved
+    HashGame sumgame(*this);
+    sumgame.m_tt = &tt;
     sumgame.set_toplay(BLACK);
     b_wins = sumgame.negamax();
     sumgame.set_toplay(WHITE);
@@ -79,20 +85,27 @@ void Game::compute()
 }
 
 std::vector<Game> Game::play(int point, Color color) const
+{
+    Game subgames[MAX_PLAY_SUBGAMES];
+    int num = play(point, color, subgames);
+    return std::vector<Game>(subgames, subgames + num);
+}
+
+// the search's version: subgames has room for MAX_PLAY_SUBGAMES games
+int Game::play(int point, Color color, Game* subgames) const
 {
     assert(is_active());
 
-    Board cboard = m_board;
+    Board cboard = m_board.to_board();
     cboard[point] = color;
     cboard = simplify_board(cboard);
-    std::vector<Board> subboards = split_board(cboard);
+    Board subboards[MAX_PLAY_SUBGAMES];
+    int num = split_board(cboard, subboards, MAX_PLAY_SUBGAMES);
 
-    std::vector<Game> subgames;
-    for (auto& subboard : subboards) {
-        Game subgame(subboard);
-        subgames.push_back(subgame);
+    for (int i = 0; i < num; i++) {
+        subgames[i] = Game(subboards[i]);
     }
-    return subgames;
+    return num;
 }
 
 char Game::get_outcome() const
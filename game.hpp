@@ -2,6 +2,7 @@
 #define GAME_H
 
 #include "board.hpp"
+#include "packed_board.hpp"
 
 const char P_PSN = 0;
 const char L_PSN = 1;
@@ -9,6 +10,8 @@ const char R_PSN = -1;
 const char N_PSN = 2;
 const char U_PSN = 3;    // unknown
 
+const int MAX_PLAY_SUBGAMES = 3;    // a move splits a game into at most this many
+
 class Game
 {
 public:
@@ -33,53 +36,49 @@ public:
 
     void set_active(bool status) { active = status; };
 
-    Board get_board() const { return m_board; };
+    Board get_board() const { return m_board.to_board(); };
     char get_outcome() const;
     void set_outcome(char outcome);
 
     std::vector<int> emtpy_points() const;
     bool is_legal_point(int point, Color color) const;
     std::vector<int> legal_points(Color color) const;
+    uint64_t legal_mask(Color color) const { return m_board.legal_mask(color); };
     bool is_eye(int point, Color color) const;
 
     void compute();
     std::vector<Game> play(int point, Color color) const;
+    int play(int point, Color color, Game* subgames) const;
 
 //private:
-    Board m_board;
+    PackedBoard m_board;
     bool b_wins, w_wins, b_computed, w_computed, active;
+    uint64_t m_hash;            // component hash, set when added to a SumGame
+    uint64_t m_inverse_hash;    // and the hash of its inverse
 };
 
+static_assert(sizeof(Game) <= 48, "games are copied by value through the search");
+
 inline Game::Game() :
     b_wins(false), w_wins(false), b_computed(false), w_computed(false),
-    active(true)
+    active(true), m_hash(0), m_inverse_hash(0)
 { }
 
 inline Game::Game(Board board) :
     m_board(board),
     b_wins(false), w_wins(false), b_computed(false), w_computed(false),
-    active(true)
+    active(true), m_hash(0), m_inverse_hash(0)
 { }
 
 inline Game::Game(Board board, bool b_wins, bool w_wins) :
     m_board(board),
     b_wins(b_wins), w_wins(w_wins), b_computed(true), w_computed(true),
-    active(true)
+    active(true), m_hash(0), m_inverse_hash(0)
 { }
 
 inline bool Game::is_reverse(const Game& other) const
 {
-    if (m_board.size != other.m_board.size)
-        return false;
-    int size = m_board.size;
-    
-    int i = 0;
-    while (i < size) {
-        if (m_board[i] != other.m_board[size-i-1])
-            return false;
-        i++;
-    }
-    return true;
+    return m_board == other.m_board.reversed();
 }
 
 inline bool Game::is_inverse(const Game& other) const
@@ -87,16 +86,8 @@ inline bool Game::is_inverse(const Game& other) const
     if (m_board.size != other.m_board.size) {
         return false;
     }
-    int size = m_board.size;
-    
-    bool inverse0 = true, inverse1 = true;
-    int i = 0;
-    while ((inverse0 || inverse1) && i < size) {
-        inverse0 &= m_board[i] == opp_color(other.m_board[i]);
-        inverse1 &= m_board[i] == opp_color(other.m_board[size-i-1]);
-        i++;
-    }
-    return inverse0 || inverse1;
+    PackedBoard inverse = other.m_board.inversed();
+    return m_board == inverse || m_board == inverse.reversed();
 }
 
 inline bool Game::operator==(const Game& rhs) const
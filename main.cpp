@@ -3,88 +3,544 @@
 #include <cmath>
 #include <fstream>
 #include <chrono>
+#include <sstream>
+#include <cstring>
+#include <cerrno>
+#include <climits>
 #include <signal.h>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include "board.hpp"
 #include "cache.hpp"
 #include "sumgame.hpp"
+#include "dfpn.hpp"
+#include "move_ordering.hpp"
+#include "checkpoint.hpp"
+#include "coordinator.hpp"
+#include "pair_db.hpp"
 #include "zobrist_hash.hpp"
+#include "search_stats.hpp"
 
 Cache cache;
-ZobristHash hash(36, 27, 4);
+PairDB pair_db;
+ZobristHash hash;
+DfpnTable dfpn_table;    // proof numbers of --engine dfpn, kept across queries
 
-std::vector<Game> process_inputs(int argc, char** argv);
+const uint64_t DEFAULT_TT_MB = 1024;
+const double DEFAULT_CHECKPOINT_INTERVAL = 600;
+const int DEFAULT_SPLIT_DEPTH = 2;
+
+std::vector<Game> process_inputs(const std::vector<std::string>& boards);
+
+struct SolveOptions
+{
+    std::string engine = "negamax";
+    std::string ordering = "heat";
+    int num_threads = 1;
+    uint64_t dfpn_mb = 0;    // of dfpn_table
+    RootProgress* progress = nullptr;
+    SearchBudget budget;    // negamax only
+    Coordinator* coordinator = nullptr;    // solves on worker processes when set
+};
+
+int solve(const std::vector<Game>& games, int toplay, const SolveOptions& options, uint64_t& nodes);
+std::string outcome_string(int outcome);
+std::string answer_query(const std::string& query, const SolveOptions& options);
+int serve_socket(const std::string& path, const SolveOptions& options);
+void print_usage();
+bool parse_number(const char* s, int& value);
+bool parse_number(const char* s, uint64_t& value);
+bool parse_number(const char* s, double& value);
 
 
 int main(int argc, char** argv)
 {
-    if (argc < 3) {
-        std::cout << "usage: solver_main [board...] [player]\n\n" <<
-                        "    board\tstring of .ox\n" <<
-                        "    player\tb or w\n\n" <<
-                        "  example: solver_main .x..ox. b\n";
+    uint64_t tt_mb = DEFAULT_TT_MB;
+    std::string tt_file;
+    int num_threads = 1;
+    std::string engine = "negamax";
+    std::string ordering = "heat";
+    bool batch = false;
+    std::string socket_path;
+    bool generate_db = false;
+    int db_max_empty = MAX_NUM_EMPTY;
+    int extend_db = 0;
+    int check_legal_mask = 0;
+    int pair_db_empty = DEFAULT_PAIR_DB_EMPTY;
+    int generate_pair_db = 0;
+    double stats_interval = 0;
+    std::string stats_json;
+    std::string checkpoint;
+    double checkpoint_interval = DEFAULT_CHECKPOINT_INTERVAL;
+    SearchBudget budget;
+    int num_workers = 0;
+    std::string worker_cmd;
+    int split_depth = DEFAULT_SPLIT_DEPTH;
+    std::vector<std::string> args;
+    std::string bad_option;    // the first option whose value is not a number
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        // the next argument as a number of the type of value
+        auto number = [&](auto value) {
+            if (! parse_number(argv[++i], value) && bad_option.empty())
+                bad_option = arg + " " + argv[i];
+            return value;
+        };
+        if (arg == "--tt-mb" && i+1 < argc) {
+            tt_mb = number(tt_mb);
+        }
+        else if (arg == "--tt-file" && i+1 < argc) {
+            tt_file = argv[++i];
+        }
+        else if (arg == "--threads" && i+1 < argc) {
+            num_threads = std::max(1, number(num_threads));
+        }
+        else if (arg == "--engine" && i+1 < argc) {
+            engine = argv[++i];
+        }
+        else if (arg == "--ordering" && i+1 < argc) {
+            ordering = argv[++i];
+        }
+        else if (arg == "--batch") {
+            batch = true;
+        }
+        else if (arg == "--socket" && i+1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (arg == "--generate-db") {
+            generate_db = true;
+        }
+        else if (arg == "--extend-db" && i+1 < argc) {
+            extend_db = std::min(number(extend_db), MAX_DB_NUM_EMPTY);
+        }
+        else if (arg == "--pair-db" && i+1 < argc) {
+            pair_db_empty = std::min(number(pair_db_empty), MAX_PAIR_DB_EMPTY);
+        }
+        else if (arg == "--generate-pair-db" && i+1 < argc) {
+            generate_pair_db = std::min(number(generate_pair_db), MAX_PAIR_DB_EMPTY);
+        }
+        else if (arg == "--check-legal-mask" && i+1 < argc) {
+            check_legal_mask = std::min(number(check_legal_mask), MAX_DB_NUM_EMPTY);
+        }
+        else if (arg == "--stats-interval" && i+1 < argc) {
+            stats_interval = number(stats_interval);
+        }
+        else if (arg == "--stats-json" && i+1 < argc) {
+            stats_json = argv[++i];
+        }
+        else if (arg == "--checkpoint" && i+1 < argc) {
+            checkpoint = argv[++i];
+        }
+        else if (arg == "--checkpoint-interval" && i+1 < argc) {
+            checkpoint_interval = number(checkpoint_interval);
+        }
+        else if (arg == "--max-nodes" && i+1 < argc) {
+            budget.max_nodes = number(budget.max_nodes);
+        }
+        else if (arg == "--max-time" && i+1 < argc) {
+            budget.max_seconds = number(budget.max_seconds);
+        }
+        else if (arg == "--workers" && i+1 < argc) {
+            num_workers = std::max(0, number(num_workers));
+        }
+        else if (arg == "--worker-cmd" && i+1 < argc) {
+            worker_cmd = argv[++i];
+        }
+        else if (arg == "--split-depth" && i+1 < argc) {
+            split_depth = std::max(0, number(split_depth));
+        }
+        else if (arg == "--db-max-empty" && i+1 < argc) {
+            db_max_empty = std::min(number(db_max_empty), MAX_DB_NUM_EMPTY);
+        }
+        else {
+            args.push_back(arg);
+        }
+    }
+    if (! bad_option.empty()) {
+        std::cerr << "not a number: " << bad_option << "\n";
+        print_usage();
+        return 1;
+    }
+
+    if (generate_db) {
+        mkdir("./db", 0755);
+        cache.compute_outcome(false, num_threads);
+        return 0;
+    }
+
+    if (extend_db > MAX_NUM_EMPTY) {
+        cache.load_outcomes(MAX_NUM_EMPTY);
+        cache.extend_outcomes(extend_db, num_threads);
+        return 0;
+    }
+
+    if (check_legal_mask > 0) {
+        cache.load_outcomes(check_legal_mask);
+        int levels = std::min(check_legal_mask, cache.max_num_empty());
+        if (! exp_check_legal_mask(cache, levels))
+            return 1;
+        std::cout << "legal masks match is_legal_point on DB levels 1.." << levels << "\n";
         return 0;
     }
-    int toplay = (argv[argc-1][0]=='b') ? BLACK : WHITE;
+
+    if (generate_pair_db >= 2) {
+        cache.load_outcomes(std::max(db_max_empty, generate_pair_db-1));
+        return pair_db.compute(generate_pair_db, num_threads) ? 0 : 1;
+    }
+
+    bool serve = batch || ! socket_path.empty();
+    if ((! serve && args.size() < 2) || (engine != "negamax" && engine != "dfpn") || ! make_move_ordering(ordering)) {
+        print_usage();
+        return 0;
+    }
+
+    SolveOptions options;
+    options.engine = engine;
+    options.ordering = ordering;
+    options.num_threads = num_threads;
+    options.budget = budget;
+    if (engine == "dfpn" && num_threads > 1)
+        std::cerr << "--threads only applies to negamax; df-pn searches on one thread\n";
+    if (engine == "dfpn" && num_workers == 0 && (budget.max_nodes > 0 || budget.max_seconds > 0))
+        std::cerr << "--max-nodes and --max-time only apply to negamax, or to the whole solve with --workers\n";
+    // the coordinator's own table is too small to save or map
+    if (num_workers > 0 && (! checkpoint.empty() || ! tt_file.empty())) {
+        std::cerr << "--checkpoint and --tt-file cannot be used with --workers, "
+                     "whose transposition tables are in the worker processes\n";
+        return 1;
+    }
+    // df-pn splits the budget between solved results and proof numbers
+    options.dfpn_mb = engine == "dfpn" ? tt_mb / 2 : 0;
+    if (num_workers > 0) {
+        // the workers search; the coordinator only expands the root
+        hash.resize(MIN_TT_MB);
+    }
+    else if (! tt_file.empty()) {
+        if (! hash.map_file(tt_file, tt_mb - options.dfpn_mb)) {
+            std::cerr << "cannot map transposition table file " << tt_file << "\n";
+            return 1;
+        }
+        std::cerr << "tt file " << tt_file << ": " << hash.size() << "/" << hash.capacity() << " entries\n";
+    }
+    else if (! hash.resize(tt_mb - options.dfpn_mb)) {
+        std::cerr << "cannot allocate " << tt_mb << "MB transposition table\n";
+        return 1;
+    }
+    // one table for all the queries of --batch and --socket
+    if (engine == "dfpn" && num_workers == 0 && ! dfpn_table.resize(options.dfpn_mb)) {
+        std::cerr << "cannot allocate " << options.dfpn_mb << "MB proof number table\n";
+        return 1;
+    }
     
-    cache.load_outcomes(MAX_NUM_EMPTY);
+    cache.load_outcomes(db_max_empty);
+    if (pair_db_empty > 0 && ! pair_db.load(pair_db_empty) && pair_db_empty != DEFAULT_PAIR_DB_EMPTY)
+        std::cerr << "cannot load ./db/pairs_" << pair_db_empty << ".db\n";
+
+    std::unique_ptr<Coordinator> coordinator;
+    if (num_workers > 0) {
+        if (worker_cmd.empty()) {
+            worker_cmd = "'" + std::string(argv[0]) + "' --batch --tt-mb " + std::to_string(tt_mb) +
+                         " --engine " + engine + " --threads " + std::to_string(num_threads) +
+                         " --ordering " + ordering + " --db-max-empty " + std::to_string(db_max_empty) +
+                         " --pair-db " + std::to_string(pair_db_empty);
+            // no query can use more than the whole solve; the coordinator enforces the total
+            if (engine == "negamax" && budget.max_nodes > 0)
+                worker_cmd += " --max-nodes " + std::to_string(budget.max_nodes);
+            if (engine == "negamax" && budget.max_seconds > 0)
+                worker_cmd += " --max-time " + std::to_string(budget.max_seconds);
+        }
+        else if (budget.max_nodes > 0 || budget.max_seconds > 0) {
+            std::cerr << "--max-nodes and --max-time limit the whole solve, not the queries of --worker-cmd\n";
+        }
+        coordinator.reset(new Coordinator(worker_cmd, num_workers, split_depth));
+        if (! coordinator->start()) {
+            std::cerr << "cannot start workers: " << worker_cmd << "\n";
+            return 1;
+        }
+        options.coordinator = coordinator.get();
+    }
+
+    if ((stats_interval > 0 || ! stats_json.empty()) && ! SEARCH_STATS_ENABLED)
+        std::cerr << "search stats are not compiled in; rebuild with make STATS=1\n";
+    start_search_stats();
+    if (stats_interval > 0) {
+        start_search_stats_reporter(stats_interval);
+        signal(SIGALRM, negamax_sig_handler);
+    }
+
+    // a checkpoint's entries are valid for any position; its refuted root
+    // moves only for the position it was saved from
+    RootProgress root_progress;
+    if (! checkpoint.empty()) {
+        if (load_checkpoint(checkpoint, hash, root_progress)) {
+            std::cerr << "resumed from " << checkpoint << ": " << hash.size() << " entries, "
+                      << root_progress.num_refuted() << " refuted root moves\n";
+        }
+        options.progress = &root_progress;
+        start_checkpointer(checkpoint, checkpoint_interval, hash, root_progress);
+    }
+
+    auto finish = [&]() {
+        stop_search_stats_reporter();
+        if (! stats_json.empty()) {
+            std::ofstream f(stats_json);
+            dump_search_stats_json(f);
+        }
+        if (! checkpoint.empty()) {
+            stop_checkpointer();
+            if (! save_checkpoint(checkpoint, hash, root_progress))
+                std::cerr << "cannot write checkpoint " << checkpoint << "\n";
+        }
+    };
+
+    if (! socket_path.empty())
+        return serve_socket(socket_path, options);
+    if (batch) {
+        std::string query;
+        while (std::getline(std::cin, query)) {
+            std::string result = answer_query(query, options);
+            if (! result.empty())
+                std::cout << result << std::endl;
+        }
+        finish();
+        return 0;
+    }
 
-    std::vector<Game> games = process_inputs(argc, argv);
-    HashGame sumgame(games);
-    sumgame.set_toplay(toplay);
-    std::vector<std::pair<Game, int>> sorted_games = sort_active_games(sumgame.m_subgames);
-    uint64_t hashcode = hash_func(hash, sorted_games);
+    int toplay = (args.back()[0]=='b') ? BLACK : WHITE;
+    args.pop_back();
 
-    //signal(SIGALRM, negamax_sig_handler);
-    //alarm(10);
+    std::vector<Game> games = process_inputs(args);
 
+    uint64_t nodes = 0;
     auto beg = std::chrono::high_resolution_clock::now();
-    bool win = sumgame.negamax(hashcode, sorted_games, 1);
+    int outcome = solve(games, toplay, options, nodes);
     auto end = std::chrono::high_resolution_clock::now();
 
-    //alarm(0);
-    //std::fprintf(stderr, "\33[2K\r");
-
     auto ms_int = std::chrono::duration_cast<std::chrono::seconds>(end - beg);
 
-    std::cout << win << "\t" << ms_int.count() << "s\t" << hash.size2() << " nodes\n";
+    std::cout << outcome_string(outcome) << "\t" << ms_int.count() << "s\t" << nodes << " nodes\n";
+    std::cerr << "tt " << hash.size() << "/" << hash.capacity() << " entries\n";
 
+    finish();
     return 0;
 }
 
 
-std::vector<Game> process_inputs(int argc, char** argv)
+// 1 for a win of toplay, 0 for a loss, -1 if out of budget or memory
+int solve(const std::vector<Game>& games, int toplay, const SolveOptions& options, uint64_t& nodes)
+{
+    if (options.coordinator)
+        return options.coordinator->solve(games, toplay, nodes, options.budget);
+    if (options.engine == "dfpn") {
+        if (! dfpn_table.ok()) {
+            std::cerr << "no proof number table\n";
+            return -1;
+        }
+        std::vector<Game> copy = games;
+        DfpnGame sumgame(copy, dfpn_table);
+        sumgame.set_toplay(toplay);
+        bool win = sumgame.solve();
+        nodes = sumgame.m_nodes;
+        return win;
+    }
+    return parallel_negamax(games, toplay, options.num_threads, nodes, options.ordering, options.progress, options.budget);
+}
+
+std::string outcome_string(int outcome)
+{
+    return outcome == -1 ? "unknown" : std::to_string(outcome);
+}
+
+// "board... player" -> "win<TAB>ms<TAB>nodes", win being 1, 0 or unknown; "" for a blank query
+std::string answer_query(const std::string& query, const SolveOptions& options)
+{
+    std::istringstream in(query);
+    std::vector<std::string> args;
+    for (std::string arg; in >> arg; ) {
+        args.push_back(arg);
+    }
+    if (args.empty())
+        return "";
+    if (args.size() < 2 || (args.back() != "b" && args.back() != "w"))
+        return "error\texpected: board... player";
+    int toplay = args.back() == "b" ? BLACK : WHITE;
+    args.pop_back();
+    for (const std::string& board : args) {
+        if ((int)board.size() > MAX_BOARD_LEN || board.find_first_not_of(".xo") != std::string::npos)
+            return "error\tinvalid board " + board;
+    }
+
+    auto beg = std::chrono::high_resolution_clock::now();
+    std::vector<Game> games = process_inputs(args);
+    uint64_t nodes = 0;
+    int outcome = solve(games, toplay, options, nodes);
+    auto end = std::chrono::high_resolution_clock::now();
+
+    auto ms_int = std::chrono::duration_cast<std::chrono::milliseconds>(end - beg);
+    return outcome_string(outcome) + "\t" + std::to_string(ms_int.count()) + "ms\t" + std::to_string(nodes) + " nodes";
+}
+
+// serve queries from clients of a Unix socket, one connection at a time
+int serve_socket(const std::string& path, const SolveOptions& options)
+{
+    sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "socket path too long: " << path << "\n";
+        return 1;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path.c_str());
+    if (server == -1 || bind(server, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(server, 8) != 0) {
+        std::cerr << "cannot listen on " << path << "\n";
+        return 1;
+    }
+    std::cerr << "listening on " << path << "\n";
+
+    for (;;) {
+        int client = accept(server, nullptr, nullptr);
+        if (client == -1)
+            continue;
+
+        std::string pending;
+        char buffer[4096];
+        ssize_t count;
+        while ((count = read(client, buffer, sizeof(buffer))) > 0) {
+            pending.append(buffer, count);
+            size_t pos;
+            while ((pos = pending.find('\n')) != std::string::npos) {
+                std::string result = answer_query(pending.substr(0, pos), options);
+                pending.erase(0, pos+1);
+                if (result.empty())
+                    continue;
+                result += "\n";
+                // a client that hung up must not take the server down with SIGPIPE
+                if (send(client, result.data(), result.size(), MSG_NOSIGNAL) < 0) {
+                    pending.clear();
+                    break;
+                }
+            }
+        }
+        // last query without a newline
+        std::string result = answer_query(pending, options);
+        if (! result.empty()) {
+            result += "\n";
+            send(client, result.data(), result.size(), MSG_NOSIGNAL);
+        }
+        close(client);
+    }
+}
+
+
+std::vector<Game> process_inputs(const std::vector<std::string>& boards)
 {
-    std::vector<Game> tmp_games;
-    for (int i = 1; i < argc-1; i++) {
-        Board board = simplify_board(string_to_board(argv[i]));
+    // inverse pairs cancel through the inverse index of a SumGame
+    SumGame sum;
+    for (const std::string& sboard : boards) {
+        Board board = simplify_board(string_to_board(sboard));
         std::vector<Board> subboards = split_board(board);
         for (Board& subboard : subboards) {
             Game game(subboard);
             cache.lookup(game);
-            if (game.is_computed_zero()) {
-                game.set_active(false);
-            }
-            else {
-                game.m_board = ordered_symmetry(game.m_board);
-                int size = (int)tmp_games.size();
-                for (int j = 0; j < size; j++) {
-                    if (tmp_games[j].is_active() && game.is_inverse(tmp_games[j])) {
-                        tmp_games[j].set_active(false);
-                        game.set_active(false);
-                        break;
-                    }
-                }
-            }
-            tmp_games.push_back(game);
+            if (game.is_computed_zero())
+                continue;
+            int inverse = sum.find_inverse(game);
+            if (inverse != -1)
+                sum.deactivate(inverse);
+            else
+                sum.add(game);
         }
     }
 
     std::vector<Game> games;
-    for (Game& game : tmp_games) {
+    for (Game& game : sum.m_subgames) {
         if (game.is_active())
             games.push_back(game);
     }
     return games;
 }
+
+void print_usage()
+{
+    std::cout << "usage: solver_main [options] [board...] [player]\n\n" <<
+                    "    board\tstring of .ox\n" <<
+                    "    player\tb or w\n\n" <<
+                    "  options:\n" <<
+                    "    --tt-mb N\ttransposition table size in MB (default " << DEFAULT_TT_MB << ")\n" <<
+                    "    --tt-file FILE\tkeep the transposition table in FILE, created with --tt-mb MB if\n" <<
+                    "    \t\tmissing, so that its results carry over to later runs\n" <<
+                    "    --threads N\tnumber of negamax search threads (default 1)\n" <<
+                    "    --engine E\tnegamax or dfpn (default negamax)\n" <<
+                    "    --ordering O\tnegamax move ordering: middle, history or heat (default heat)\n" <<
+                    "    --db-max-empty N\talso use the on-disk DB levels up to N (default " << MAX_NUM_EMPTY << ")\n" <<
+                    "    --pair-db K\tuse ./db/pairs_K.db if present, 0 for none (default " << DEFAULT_PAIR_DB_EMPTY << ")\n" <<
+                    "    --stats-interval S\tprint search stats every S seconds and on SIGALRM (make STATS=1)\n" <<
+                    "    --stats-json FILE\twrite search stats as JSON to FILE at exit (make STATS=1)\n" <<
+                    "    --checkpoint FILE\tresume from FILE if it exists, and save the transposition table\n" <<
+                    "    \t\tand the refuted root moves to it periodically and at exit (only the\n" <<
+                    "    \t\trefuted root moves with --tt-file, whose file has the entries)\n" <<
+                    "    --checkpoint-interval S\tseconds between checkpoints (default " << DEFAULT_CHECKPOINT_INTERVAL << ")\n" <<
+                    "    --max-nodes N\tgive up each negamax solve after about N nodes, with result unknown\n" <<
+                    "    --max-time S\tgive up each negamax solve after S seconds, with result unknown\n" <<
+                    "    --workers N\tsolve on N worker processes, each with its own DB and transposition table\n" <<
+                    "    \t\t(not with --checkpoint or --tt-file)\n" <<
+                    "    --worker-cmd CMD\tshell command of a worker (default: this solver_main --batch with the\n" <<
+                    "    \t\t--tt-mb, --engine, --threads, --ordering, --db-max-empty, --pair-db,\n" <<
+                    "    \t\t--max-nodes and --max-time given here)\n" <<
+                    "    --split-depth D\tplies the root is expanded before positions go to the workers\n" <<
+                    "    \t\t(default " << DEFAULT_SPLIT_DEPTH << ")\n\n" <<
+                    "  solver_main [options] --batch\n" <<
+                    "  solver_main [options] --socket PATH\n" <<
+                    "    answers queries \"board... player\", one per line, from stdin or a Unix socket;\n" <<
+                    "    the DB and the transposition table stay loaded across queries\n\n" <<
+                    "  solver_main --generate-db [--threads N]\n" <<
+                    "    computes all DB levels with N threads and stores them in ./db/\n\n" <<
+                    "  solver_main --check-legal-mask N\n" <<
+                    "    checks the packed boards and legal masks against Game on DB levels up to N\n\n" <<
+                    "  solver_main --extend-db N [--threads N]\n" <<
+                    "    computes the on-disk DB levels up to N (at most " << MAX_DB_NUM_EMPTY << ") in ./db/\n\n" <<
+                    "  solver_main --generate-pair-db K [--threads N]\n" <<
+                    "    computes the outcomes of all sums of two DB positions of at most K (at most " << MAX_PAIR_DB_EMPTY << ")\n" <<
+                    "    empty points together in ./db/pairs_K.db\n\n" <<
+                    "  example: solver_main .x..ox. b\n";
+}
+
+// the whole of s must be the number: "12x" or "" is an error, not 12 or 0
+bool parse_number(const char* s, int& value)
+{
+    char* end;
+    errno = 0;
+    long x = std::strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || x < INT_MIN || x > INT_MAX)
+        return false;
+    value = (int)x;
+    return true;
+}
+
+bool parse_number(const char* s, uint64_t& value)
+{
+    char* end;
+    errno = 0;
+    // strtoull takes "-1" for the largest value
+    unsigned long long x = std::strtoull(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || std::strchr(s, '-'))
+        return false;
+    value = x;
+    return true;
+}
+
+bool parse_number(const char* s, double& value)
+{
+    char* end;
+    errno = 0;
+    double x = std::strtod(s, &end);
+    if (end == s || *end != '\0' || errno != 0 || ! std::isfinite(x))
+        return false;
+    value = x;
+    return true;
+}
@@ -0,0 +1,198 @@
+#include <iostream>
+#include <chrono>
+#include <random>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+#include "board.hpp"
+#include "game.hpp"
+#include "cache.hpp"
+#include "pair_db.hpp"
+#include "zobrist_hash.hpp"
+#include "sumgame.hpp"
+
+Cache cache;
+PairDB pair_db;    // not loaded: kernels measure the search without it
+ZobristHash hash;
+
+const int DEFAULT_NUM_SAMPLES = 4096;
+const int NUM_SEARCHES = 256;
+const int MAX_SEARCH_EMPTY = 20;    // empty points of a searched sum
+const double MIN_SECONDS = 0.2;    // per kernel
+
+volatile uint64_t sink;    // keeps kernel results alive
+
+/////////////////////// allocation counter ///////////////////////
+
+static uint64_t num_allocs = 0;
+
+void* operator new(std::size_t size)
+{
+    num_allocs++;
+    void* ptr = std::malloc(size ? size : 1);
+    if (ptr == nullptr)
+        throw std::bad_alloc();
+    return ptr;
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+/////////////////////// samples ///////////////////////
+
+// a DB position with a random legal move
+struct Sample
+{
+    Game game;
+    Color color;
+    int point;
+    Board played;        // the board right after the move
+    Board simplified;    // and simplified
+};
+
+std::vector<Sample> sample_positions(int num_samples)
+{
+    std::mt19937_64 rng(2024);
+    int64_t total = cache.m_accum_sizes[cache.max_num_empty()+1];
+
+    std::vector<Sample> samples;
+    while ((int)samples.size() < num_samples) {
+        Sample s;
+        s.game = Game(cache.board(rng() % total));
+        s.color = rng() % 2 ? BLACK : WHITE;
+        std::vector<int> legal_points = s.game.legal_points(s.color);
+        if (legal_points.empty())
+            continue;
+        s.point = legal_points[rng() % legal_points.size()];
+        s.played = s.game.get_board();
+        s.played[s.point] = s.color;
+        s.simplified = simplify_board(s.played);
+        samples.push_back(s);
+    }
+    return samples;
+}
+
+/////////////////////// kernels ///////////////////////
+
+// run f over all samples for at least MIN_SECONDS; print ns/op and allocations/op
+template <typename F>
+void bench(const std::string& name, const std::vector<Sample>& samples, F f)
+{
+    uint64_t sum = 0;
+    for (const Sample& s : samples) {
+        sum += f(s);    // warm up
+    }
+
+    uint64_t ops = 0;
+    uint64_t allocs = num_allocs;
+    auto beg = std::chrono::steady_clock::now();
+    double elapsed = 0;
+    while (elapsed < MIN_SECONDS) {
+        for (const Sample& s : samples) {
+            sum += f(s);
+        }
+        ops += samples.size();
+        elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+    }
+    allocs = num_allocs - allocs;
+    sink = sum;
+
+    std::printf("%-20s %10.1f ns/op %8.2f allocs/op\n", name.c_str(), 1e9 * elapsed / ops, (double)allocs / ops);
+}
+
+// HashGame::negamax on sums of DB positions from an empty TT; only the
+// search itself is timed and counted, not the setup of the HashGame
+void bench_search(const std::vector<Sample>& samples)
+{
+    double elapsed = 0;
+    uint64_t nodes = 0, allocs = 0;
+    int num_searches = 0;
+    for (int i = 0; i+1 < (int)samples.size() && num_searches < NUM_SEARCHES; i += 2) {
+        std::vector<Game> games;
+        int num_empty = 0;
+        for (int j = i; j < i+2; j++) {
+            Game g = samples[j].game;
+            cache.lookup(g, false);
+            Board board = g.get_board();
+            num_empty += std::count(board.begin(), board.end(), EMPTY);
+            if (! g.is_computed_zero())
+                games.push_back(g);
+        }
+        if (games.empty() || num_empty > MAX_SEARCH_EMPTY)
+            continue;
+        num_searches++;
+        hash.resize(MIN_TT_MB);
+        HashGame sumgame(games);
+        sumgame.set_toplay(samples[i].color);
+
+        uint64_t start_allocs = num_allocs;
+        auto beg = std::chrono::steady_clock::now();
+        sink = sumgame.negamax(1);
+        elapsed += std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+        allocs += num_allocs - start_allocs;
+        nodes += sumgame.m_nodes;
+    }
+
+    std::printf("%-20s %10.1f ns/node %6.2f allocs/node (%d searches, %llu nodes)\n", "HashGame::negamax",
+                1e9 * elapsed / std::max(nodes, (uint64_t)1), (double)allocs / std::max(nodes, (uint64_t)1),
+                num_searches, (unsigned long long)nodes);
+}
+
+int main(int argc, char** argv)
+{
+    int num_samples = argc > 1 ? std::max(1, std::atoi(argv[1])) : DEFAULT_NUM_SAMPLES;
+    if (! hash.resize(MIN_TT_MB)) {
+        std::cerr << "cannot allocate transposition table\n";
+        return 1;
+    }
+    cache.load_outcomes(MAX_NUM_EMPTY);
+    if (cache.max_num_empty() == 0) {
+        std::cerr << "no DB levels in ./db/\n";
+        return 1;
+    }
+    std::vector<Sample> samples = sample_positions(num_samples);
+    std::cout << samples.size() << " samples from DB levels 1.." << cache.max_num_empty() << std::endl;
+
+    bench("simplify_board", samples, [](const Sample& s) {
+        return (uint64_t)simplify_board(s.played).size;
+    });
+    bench("split_board", samples, [](const Sample& s) {
+        Board subboards[MAX_BOARD_LEN];
+        return (uint64_t)split_board(s.simplified, subboards, MAX_BOARD_LEN);
+    });
+    bench("ordered_symmetry", samples, [](const Sample& s) {
+        return (uint64_t)ordered_symmetry(s.game.get_board()).size;
+    });
+    bench("Game::legal_points", samples, [](const Sample& s) {
+        return (uint64_t)s.game.legal_points(s.color).size();
+    });
+    bench("Game::legal_mask", samples, [](const Sample& s) {
+        return s.game.legal_mask(s.color);
+    });
+    bench("Game::play", samples, [](const Sample& s) {
+        Game subgames[MAX_PLAY_SUBGAMES];
+        return (uint64_t)s.game.play(s.point, s.color, subgames);
+    });
+    bench("Cache::hash_func", samples, [](const Sample& s) {
+        return (uint64_t)cache.hash_func(s.game.get_board());
+    });
+    bench("Cache::lookup", samples, [](const Sample& s) {
+        Game g = s.game;
+        cache.lookup(g);
+        return (uint64_t)g.get_outcome();
+    });
+    bench("zobrist hash_func", samples, [](const Sample& s) {
+        return hash_func(hash, s.game.m_board);
+    });
+    bench_search(samples);
+    return 0;
+}
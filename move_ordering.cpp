@@ -0,0 +1,161 @@
+#include <algorithm>
+
+#include "move_ordering.hpp"
+
+const uint32_t HISTORY_LIMIT = 1 << 30;    // counters are halved before they overflow
+
+/////////////////////// MiddleOrdering ///////////////////////
+
+void MiddleOrdering::order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves)
+{
+    // sum.m_order as scratch, dropped again before returning
+    size_t order_begin = sum.m_order.size();
+    int subgames_size = sort_active_games(sum.m_subgames, sum.m_order);
+    for (int k = subgames_size-1; k >= 0; k--) {
+        int subgame = sum.m_order[order_begin + k];
+
+        uint64_t legal_points = sum.m_subgames[subgame].legal_mask(sum.m_toplay);
+        int size = __builtin_popcountll(legal_points);
+        for (int i = 0; i < size; i++) {
+            int idx = (size-i) / 2;
+            if (thread_id > 0 && depth < HELPER_REORDER_DEPTH)
+                idx = (idx + thread_id + depth) % (size-i);
+            int point = select_bit(legal_points, idx);
+            moves.push_back(Move{subgame, point});
+            legal_points &= ~((uint64_t)1 << point);
+        }
+    }
+    sum.m_order.resize(order_begin);
+}
+
+/////////////////////// IndexOrdering ///////////////////////
+
+void IndexOrdering::order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves)
+{
+    int num_subgames = (int)sum.m_subgames.size();
+    for (int j = 0; j < num_subgames; j++) {
+        if (! sum.m_subgames[j].is_active())
+            continue;
+        uint64_t legal_points = sum.m_subgames[j].legal_mask(sum.m_toplay);
+        int size = __builtin_popcountll(legal_points);
+        for (int i = 0; i < size; i++) {
+            int point = select_bit(legal_points, (size-i) / 2);
+            moves.push_back(Move{j, point});
+            legal_points &= ~((uint64_t)1 << point);
+        }
+    }
+}
+
+/////////////////////// HistoryOrdering ///////////////////////
+
+HistoryOrdering::HistoryOrdering() : m_history((size_t)1 << HISTORY_BITS, 0)
+{ }
+
+uint32_t& HistoryOrdering::history(uint64_t hash, int point)
+{
+    uint64_t key = (hash ^ (uint64_t)point) * 0x9e3779b97f4a7c15;
+    return m_history[key >> (64 - HISTORY_BITS)];
+}
+
+void HistoryOrdering::order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves)
+{
+    size_t begin = moves.size();
+    default_move_ordering().order(sum, depth, thread_id, moves);
+    size_t num = moves.size() - begin;
+
+    const Killer* killers = m_killers[std::min(depth, KILLER_MAX_DEPTH-1)];
+    m_scores.resize(num);
+    for (size_t i = 0; i < num; i++) {
+        const Move& move = moves[begin + i];
+        uint64_t hash = sum.m_subgames[move.subgame].m_hash;
+        uint64_t score = history(hash, move.point);
+        if (killers[1].hash == hash && killers[1].point == move.point)
+            score = (uint64_t)HISTORY_LIMIT * 2;
+        if (killers[0].hash == hash && killers[0].point == move.point)
+            score = (uint64_t)HISTORY_LIMIT * 3;
+        // the middle order breaks ties
+        m_scores[i] = score << 32 | (uint32_t)~i;
+    }
+
+    std::sort(m_scores.begin(), m_scores.end(), std::greater<uint64_t>());
+    // moves of the slice, reordered through the tail of moves
+    for (size_t i = 0; i < num; i++) {
+        Move move = moves[begin + (uint32_t)~m_scores[i]];
+        moves.push_back(move);
+    }
+    std::copy(moves.begin() + begin + num, moves.end(), moves.begin() + begin);
+    moves.resize(begin + num);
+}
+
+void HistoryOrdering::cutoff(const SumGame& sum, const Move& move, int depth)
+{
+    uint64_t hash = sum.m_subgames[move.subgame].m_hash;
+
+    // refutations near the root save the most work
+    uint32_t& counter = history(hash, move.point);
+    counter += std::max(1, KILLER_MAX_DEPTH - depth);
+    if (counter >= HISTORY_LIMIT) {
+        for (uint32_t& c : m_history) {
+            c /= 2;
+        }
+    }
+
+    Killer* killers = m_killers[std::min(depth, KILLER_MAX_DEPTH-1)];
+    if (killers[0].hash != hash || killers[0].point != move.point) {
+        killers[1] = killers[0];
+        killers[0].hash = hash;
+        killers[0].point = move.point;
+    }
+}
+
+/////////////////////// HeatOrdering ///////////////////////
+
+static int heat(const Game& g)
+{
+    if (! g.is_computed())
+        return 1;
+    return g.is_next_win() ? 2 : 0;
+}
+
+void HeatOrdering::order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves)
+{
+    size_t begin = moves.size();
+    default_move_ordering().order(sum, depth, thread_id, moves);
+    size_t num = moves.size() - begin;
+
+    // stable, hottest first, through the tail of moves
+    for (int h = 2; h >= 0; h--) {
+        for (size_t i = begin; i < begin + num; i++) {
+            Move move = moves[i];
+            if (heat(sum.m_subgames[move.subgame]) == h)
+                moves.push_back(move);
+        }
+    }
+    std::copy(moves.begin() + begin + num, moves.end(), moves.begin() + begin);
+    moves.resize(begin + num);
+}
+
+//////////////////////// FUNCTIONS ////////////////////////
+
+MoveOrdering& default_move_ordering()
+{
+    static MiddleOrdering ordering;
+    return ordering;
+}
+
+MoveOrdering& index_move_ordering()
+{
+    static IndexOrdering ordering;
+    return ordering;
+}
+
+std::unique_ptr<MoveOrdering> make_move_ordering(const std::string& name)
+{
+    if (name == "middle")
+        return std::unique_ptr<MoveOrdering>(new MiddleOrdering());
+    if (name == "history")
+        return std::unique_ptr<MoveOrdering>(new HistoryOrdering());
+    if (name == "heat")
+        return std::unique_ptr<MoveOrdering>(new HeatOrdering());
+    return nullptr;
+}
@@ -0,0 +1,83 @@
+#ifndef MOVE_ORDERING_H
+#define MOVE_ORDERING_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "sumgame.hpp"
+
+const int HELPER_REORDER_DEPTH = 6;    // helper threads reorder moves above this depth
+const int KILLER_MAX_DEPTH = 128;      // deeper nodes share the killers of the last depth
+const int HISTORY_BITS = 16;           // 2^16 history counters
+
+// Orders the moves of the player to play in a sum. A search thread owns
+// its ordering, so orderings may learn from the cutoffs of that thread.
+class MoveOrdering
+{
+public:
+    virtual ~MoveOrdering() { };
+
+    // append the moves of sum.m_toplay in search order
+    virtual void order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves) = 0;
+
+    // move refuted the position it was played in
+    virtual void cutoff(const SumGame& sum, const Move& move, int depth) { };
+};
+
+// components in reverse sort order, points from the middle of each
+// component outwards; stateless, so one instance serves all threads
+class MiddleOrdering : public MoveOrdering
+{
+public:
+    void order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves) override;
+};
+
+// components by index, points from the middle outwards: the plain
+// SumGame search, which keeps no TT, never sorted its components
+class IndexOrdering : public MoveOrdering
+{
+public:
+    void order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves) override;
+};
+
+// killer moves of the depth first, then the moves that refuted most
+// positions; ties keep the middle order. Moves are told apart by the
+// component hash and the point, since subgame indices change with play.
+class HistoryOrdering : public MoveOrdering
+{
+public:
+    HistoryOrdering();
+
+    void order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves) override;
+    void cutoff(const SumGame& sum, const Move& move, int depth) override;
+
+private:
+    struct Killer
+    {
+        uint64_t hash = 0;
+        int point = -1;
+    };
+
+    std::vector<uint32_t> m_history;
+    Killer m_killers[KILLER_MAX_DEPTH][2];
+    std::vector<uint64_t> m_scores;    // scratch, one per move of the slice
+
+    uint32_t& history(uint64_t hash, int point);
+};
+
+// hot components first: next-player wins, then those the DB does not
+// know, then the cold left and right wins; middle order within a component
+class HeatOrdering : public MoveOrdering
+{
+public:
+    void order(SumGame& sum, int depth, int thread_id, std::vector<Move>& moves) override;
+};
+
+MoveOrdering& default_move_ordering();
+MoveOrdering& index_move_ordering();
+
+/* "middle", "history" or "heat"; nullptr for any other name */
+std::unique_ptr<MoveOrdering> make_move_ordering(const std::string& name);
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef CGTPACKEDBOARD_H
+#define CGTPACKEDBOARD_H
+
+#include <stdint.h>
+#include <utility>
+
+#include "board.hpp"
+
+static_assert(MAX_BOARD_LEN <= 64, "PackedBoard holds one point per bit of a 64-bit plane");
+
+// 2 bits per point: one bit plane per color, empty = neither bit set
+class PackedBoard
+{
+public:
+    uint64_t black = 0;
+    uint64_t white = 0;
+    uint8_t size = 0;
+
+    PackedBoard() { };
+    PackedBoard(const Board& board);
+
+    Board to_board() const;
+    Point operator[](size_t pos) const;
+    bool operator==(const PackedBoard& rhs) const;
+    bool operator!=(const PackedBoard& rhs) const { return ! operator==(rhs); };
+
+    PackedBoard reversed() const;
+    PackedBoard inversed() const;
+
+    uint64_t full() const;
+    uint64_t empty() const { return full() & ~(black | white); };
+
+    uint64_t legal_mask(Color color) const;
+    void legal_masks(uint64_t& b_mask, uint64_t& w_mask) const;
+};
+
+inline PackedBoard::PackedBoard(const Board& board)
+{
+    size = board.size;
+    // BLACK = 1, WHITE = 2: bit 0 and bit 1 of the color
+    for (int i = 0; i < size; i++) {
+        black |= (uint64_t)(board[i] & 1) << i;
+        white |= (uint64_t)(board[i] >> 1) << i;
+    }
+}
+
+inline Board PackedBoard::to_board() const
+{
+    Board board;
+    board.size = size;
+    for (int i = 0; i < size; i++) {
+        board[i] = operator[](i);
+    }
+    return board;
+}
+
+inline Point PackedBoard::operator[](size_t pos) const
+{
+    return ((black >> pos) & 1) | (((white >> pos) & 1) << 1);
+}
+
+inline bool PackedBoard::operator==(const PackedBoard& rhs) const
+{
+    return size == rhs.size && black == rhs.black && white == rhs.white;
+}
+
+// bits [0, size) of x in reverse order
+inline uint64_t reverse_bits(uint64_t x, int size)
+{
+    x = ((x >> 1) & 0x5555555555555555) | ((x & 0x5555555555555555) << 1);
+    x = ((x >> 2) & 0x3333333333333333) | ((x & 0x3333333333333333) << 2);
+    x = ((x >> 4) & 0x0f0f0f0f0f0f0f0f) | ((x & 0x0f0f0f0f0f0f0f0f) << 4);
+    x = __builtin_bswap64(x);
+    return size == 0 ? 0 : x >> (64 - size);
+}
+
+inline PackedBoard PackedBoard::reversed() const
+{
+    PackedBoard board = *this;
+    board.black = reverse_bits(black, size);
+    board.white = reverse_bits(white, size);
+    return board;
+}
+
+// G -> -G
+inline PackedBoard PackedBoard::inversed() const
+{
+    PackedBoard board = *this;
+    std::swap(board.black, board.white);
+    return board;
+}
+
+// mask of the points on the board
+inline uint64_t PackedBoard::full() const
+{
+    return size == 64 ? ~(uint64_t)0 : ((uint64_t)1 << size) - 1;
+}
+
+// legal points of own stones against opp stones; bit i set iff Game::is_legal_point(i)
+inline uint64_t legal_mask(uint64_t own, uint64_t opp, uint64_t all)
+{
+    uint64_t empty = all & ~(own | opp);
+
+    uint64_t first = 1;
+    uint64_t second = 2;
+    uint64_t last = all & ~(all >> 1);
+    uint64_t second_last = (all >> 1) & ~(all >> 2);
+    uint64_t interior = (all >> 2) & ~(uint64_t)3;     // 2 <= point <= bound-2
+    uint64_t ge4 = -((all >> 3) & 1);                   // size >= 4
+    uint64_t eq3 = -(uint64_t)(all == 7);               // size == 3
+
+    // not between two opp stones
+    uint64_t l2r2 = interior & ~((opp << 1) & (opp >> 1));
+    // next to an edge stone: that stone is not opp, nor own with opp beyond us
+    uint64_t l1r2 = second & ge4 & ~(opp << 1) & ~((own << 1) & (opp >> 1));
+    uint64_t l2r1 = second_last & ge4 & ~(opp >> 1) & ~((own >> 1) & (opp << 1));
+    // middle of 3 points: an empty neighbor and no opp neighbor
+    uint64_t l1r1 = second & eq3 & ((empty << 1) | (empty >> 1)) & ~((opp << 1) | (opp >> 1));
+    // on an edge: empty neighbor, or a non-opp neighbor followed by an empty
+    uint64_t l0 = first & ((empty >> 1) | (~(opp >> 1) & (empty >> 2)));
+    uint64_t r0 = last & ((empty << 1) | (~(opp << 1) & (empty << 2)));
+
+    return empty & (l2r2 | l1r2 | l2r1 | l1r1 | l0 | r0);
+}
+
+inline uint64_t PackedBoard::legal_mask(Color color) const
+{
+    if (color == BLACK)
+        return ::legal_mask(black, white, full());
+    else
+        return ::legal_mask(white, black, full());
+}
+
+inline void PackedBoard::legal_masks(uint64_t& b_mask, uint64_t& w_mask) const
+{
+    uint64_t all = full();
+    b_mask = ::legal_mask(black, white, all);
+    w_mask = ::legal_mask(white, black, all);
+}
+
+//////////////////////// FUNCTIONS ////////////////////////
+
+// compare boards as strings, like boardcmp
+inline int boardcmp(const PackedBoard& board1, const PackedBoard& board2)
+{
+    if (board1.size != board2.size)
+        return board1.size - board2.size;
+    uint64_t diff = (board1.black ^ board2.black) | (board1.white ^ board2.white);
+    if (diff == 0)
+        return 0;
+    int i = __builtin_ctzll(diff);
+    return board1[i] - board2[i];
+}
+
+// return the smaller one of the board and its reverse
+inline PackedBoard ordered_symmetry(const PackedBoard& board)
+{
+    PackedBoard reversed = board.reversed();
+    return boardcmp(board, reversed) <= 0 ? board : reversed;
+}
+
+// cheap hash, the same for the board and its reverse
+inline uint64_t symmetric_key(const PackedBoard& board)
+{
+    uint64_t b = board.black + reverse_bits(board.black, board.size);
+    uint64_t w = board.white + reverse_bits(board.white, board.size);
+    return ((b * 0x9e3779b97f4a7c15) ^ (w * 0xc2b2ae3d27d4eb4f) ^ board.size) * 0x9e3779b97f4a7c15;
+}
+
+// index of the n-th (from 0) set bit of mask
+inline int select_bit(uint64_t mask, int n)
+{
+    assert(n < __builtin_popcountll(mask));
+    for (int i = 0; i < n; i++) {
+        mask &= mask - 1;
+    }
+    return __builtin_ctzll(mask);
+}
+
+#endif
@@ -0,0 +1,189 @@
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pair_db.hpp"
+#include "sumgame.hpp"
+#include "zobrist_hash.hpp"
+#include "utils/parallel_for.hpp"
+
+extern Cache cache;
+
+static std::string pair_db_file(int max_num_empty)
+{
+    return "./db/pairs_" + std::to_string(max_num_empty) + ".db";
+}
+
+// simplest equivalents of the nonzero positions of a level
+static std::vector<int64_t> canonical_ranks(int num_empty)
+{
+    std::vector<int64_t> ranks;
+    const DBLevel& level = cache.m_levels[num_empty];
+    for (int64_t r = 0; r < level.size; r++) {
+        const DBEntry& entry = level.entries[r];
+        if (entry.eq_idx == -1 && (entry.b_wins || entry.w_wins))
+            ranks.push_back(r);
+    }
+    return ranks;
+}
+
+// (b_wins, w_wins) of the sum of two DB positions
+static int solve_pair(int n1, int64_t r1, int n2, int64_t r2)
+{
+    ZobristHash& tt = generation_tt();
+
+    std::vector<Game> games = {Game(rank_to_board(n1, r1)), Game(rank_to_board(n2, r2))};
+    for (Game& game : games) {
+        cache.lookup(game);
+    }
+    HashGame sum(games);
+    sum.m_tt = &tt;
+    sum.set_toplay(BLACK);
+    bool b_wins = sum.negamax();
+    sum.set_toplay(WHITE);
+    bool w_wins = sum.negamax();
+    return (int)b_wins | (int)w_wins << 1;
+}
+
+/////////////////////// PairDB ///////////////////////
+
+PairDB::PairDB()
+{
+    m_level_sizes[0] = 0;
+    int64_t size = 3;
+    for (int n = 1; n < MAX_PAIR_DB_EMPTY+1; n++) {
+        size *= 3;
+        m_level_sizes[n] = size;
+    }
+
+    int64_t offset = 0;
+    m_num_entries[0] = m_num_entries[1] = 0;
+    for (int t = 2; t < MAX_PAIR_DB_EMPTY+1; t++) {
+        for (int n1 = 1; n1 <= t/2; n1++) {
+            int n2 = t - n1;
+            m_offsets[n1][n2] = offset;
+            offset += m_level_sizes[n1] * m_level_sizes[n2];
+        }
+        m_num_entries[t] = offset;
+    }
+}
+
+PairDB::~PairDB()
+{
+    release();
+}
+
+void PairDB::release()
+{
+    if (m_mapped)
+        munmap((void*)m_data, m_bytes);
+    m_data = nullptr;
+    m_bytes = 0;
+    m_mapped = false;
+    m_max_num_empty = 0;
+}
+
+int64_t PairDB::index(int n1, int64_t r1, int n2, int64_t r2) const
+{
+    return m_offsets[n1][n2] + r1 * m_level_sizes[n2] + r2;
+}
+
+bool PairDB::load(int max_num_empty)
+{
+    if (max_num_empty < 2 || max_num_empty > MAX_PAIR_DB_EMPTY || cache.max_num_empty() < max_num_empty-1)
+        return false;
+    std::string file_name = pair_db_file(max_num_empty);
+    uint64_t bytes = (m_num_entries[max_num_empty] + 3) / 4;
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd == -1)
+        return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != bytes) {
+        close(fd);
+        return false;
+    }
+    void* ptr = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return false;
+    madvise(ptr, bytes, MADV_WILLNEED);
+
+    release();
+    m_data = (const uint8_t*)ptr;
+    m_bytes = bytes;
+    m_mapped = true;
+    m_max_num_empty = max_num_empty;
+    return true;
+}
+
+// Pairs are solved by increasing # of empty points, so the search of a
+// pair already finds the smaller pairs it reaches in the table
+bool PairDB::compute(int max_num_empty, int num_threads)
+{
+    assert(max_num_empty >= 2 && max_num_empty <= MAX_PAIR_DB_EMPTY);
+    if (cache.max_num_empty() < max_num_empty-1) {
+        std::cerr << "pairs of " << max_num_empty << " empty points need the DB levels up to "
+                  << max_num_empty-1 << "\n";
+        return false;
+    }
+
+    release();
+    std::vector<uint8_t> data((m_num_entries[max_num_empty] + 3) / 4, 0);
+    m_data = data.data();
+    m_bytes = data.size();
+    for (int t = 2; t < max_num_empty+1; t++) {
+        std::cout << "\r******* PAIR NUM_EMPTY " << t << " *******\n";
+        m_max_num_empty = t-1;
+        for (int n1 = 1; n1 <= t/2; n1++) {
+            int n2 = t - n1;
+            std::vector<int64_t> ranks1 = canonical_ranks(n1);
+            std::vector<int64_t> ranks2 = canonical_ranks(n2);
+            int64_t size2 = ranks2.size();
+            parallel_for((int64_t)ranks1.size() * size2, num_threads, [&](int64_t j) {
+                int64_t r1 = ranks1[j / size2], r2 = ranks2[j % size2];
+                if (n1 == n2 && r1 > r2)
+                    return;
+                int64_t idx = index(n1, r1, n2, r2);
+                uint8_t bits = solve_pair(n1, r1, n2, r2) << (idx & 3) * 2;
+                // neighbouring pairs share the byte
+                __atomic_fetch_or(&data[idx >> 2], bits, __ATOMIC_RELAXED);
+            });
+        }
+    }
+    release();
+
+    std::string file_name = pair_db_file(max_num_empty);
+    std::ofstream out(file_name + ".tmp", std::ios::binary);
+    out.write((const char*)data.data(), data.size());
+    out.close();
+    if (! out || std::rename((file_name + ".tmp").c_str(), file_name.c_str()) != 0) {
+        std::cerr << "cannot write " << file_name << "\n";
+        return false;
+    }
+    return load(max_num_empty);
+}
+
+int PairDB::lookup(const Game& g, const Game& h, Color toplay) const
+{
+    int n1, n2;
+    int64_t r1 = cache.rank(g.m_board, n1);
+    int64_t r2 = cache.rank(h.m_board, n2);
+    if (r1 == -1 || r2 == -1 || n1 + n2 > m_max_num_empty)
+        return -1;
+    // only simplest equivalents are solved
+    if (cache.m_levels[n1].entries[r1].eq_idx != -1 || cache.m_levels[n2].entries[r2].eq_idx != -1)
+        return -1;
+    if (n1 > n2 || (n1 == n2 && r1 > r2)) {
+        std::swap(n1, n2);
+        std::swap(r1, r2);
+    }
+
+    int64_t idx = index(n1, r1, n2, r2);
+    int bits = __atomic_load_n(&m_data[idx >> 2], __ATOMIC_RELAXED) >> (idx & 3) * 2;
+    return toplay == BLACK ? bits & 1 : (bits >> 1) & 1;
+}
@@ -0,0 +1,49 @@
+#ifndef PAIR_DB_H
+#define PAIR_DB_H
+
+#include <cstdint>
+
+#include "cache.hpp"
+
+const int DEFAULT_PAIR_DB_EMPTY = 12;    // ./db/pairs_12.db is loaded if present
+const int MAX_PAIR_DB_EMPTY = MAX_NUM_EMPTY + 1;
+
+// Outcomes of the sums of two DB positions of at most max_num_empty empty
+// points together, for the sums static_winner cannot tell: N + N, L + R
+// and R + N. ./db/pairs_<K>.db holds 2 bits (b_wins, w_wins) per pair,
+// indexed by the Cache::rank of both positions, the one with fewer empty
+// points (then the smaller rank) first. Only the simplest equivalents of
+// nonzero positions are solved; they are the only ones a sum holds.
+class PairDB
+{
+public:
+    PairDB();
+    ~PairDB();
+
+    PairDB(const PairDB&) = delete;
+    PairDB& operator=(const PairDB&) = delete;
+
+    bool load(int max_num_empty);    // needs the DB levels up to max_num_empty-1
+    bool compute(int max_num_empty, int num_threads=1);
+
+    /* 1 if toplay wins g + h, 0 if it loses, -1 if the pair is not in the table */
+    int lookup(const Game& g, const Game& h, Color toplay) const;
+
+    int max_num_empty() const { return m_max_num_empty; };
+
+private:
+    const uint8_t* m_data = nullptr;
+    uint64_t m_bytes = 0;
+    bool m_mapped = false;     // m_data is a mapped file rather than the table being computed
+    int m_max_num_empty = 0;   // pairs of up to this many empty points are in m_data
+
+    int64_t m_level_sizes[MAX_PAIR_DB_EMPTY+1];    // # of ranks of a DB level
+    // start of the (n1, n2) block, n1 <= n2, in blocks of increasing n1 + n2
+    int64_t m_offsets[MAX_PAIR_DB_EMPTY+1][MAX_PAIR_DB_EMPTY+1];
+    int64_t m_num_entries[MAX_PAIR_DB_EMPTY+1];    // # of entries of pairs up to n empty points
+
+    int64_t index(int n1, int64_t r1, int n2, int64_t r2) const;
+    void release();
+};
+
+#endif
@@ -0,0 +1,187 @@
+#include <iostream>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdio>
+
+#include "search_stats.hpp"
+
+thread_local SearchStatsBlock t_search_stats;
+
+typedef std::chrono::steady_clock Clock;
+
+static std::atomic<bool> report_requested(false);
+
+/////////////////////// registry ///////////////////////
+
+struct SearchStatsRegistry
+{
+    std::mutex mutex;
+    std::vector<SearchStatsBlock*> blocks;
+    uint64_t retired[NUM_SEARCH_STATS] = {};    // counts of finished threads
+    Clock::time_point start = Clock::now();
+};
+
+static SearchStatsRegistry& registry()
+{
+    static SearchStatsRegistry instance;
+    return instance;
+}
+
+SearchStatsBlock::SearchStatsBlock()
+{
+    for (auto& counter : counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    SearchStatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.blocks.push_back(this);
+}
+
+SearchStatsBlock::~SearchStatsBlock()
+{
+    SearchStatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (int i = 0; i < NUM_SEARCH_STATS; i++) {
+        r.retired[i] += counters[i].load(std::memory_order_relaxed);
+    }
+    r.blocks.erase(std::find(r.blocks.begin(), r.blocks.end(), this));
+}
+
+void collect_search_stats(uint64_t totals[NUM_SEARCH_STATS])
+{
+    SearchStatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    for (int i = 0; i < NUM_SEARCH_STATS; i++) {
+        totals[i] = r.retired[i];
+    }
+    for (SearchStatsBlock* block : r.blocks) {
+        for (int i = 0; i < NUM_SEARCH_STATS; i++) {
+            totals[i] += block->counters[i].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void start_search_stats()
+{
+    SearchStatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.start = Clock::now();
+}
+
+static double elapsed_seconds()
+{
+    SearchStatsRegistry& r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return std::chrono::duration<double>(Clock::now() - r.start).count();
+}
+
+static double ratio(uint64_t a, uint64_t b)
+{
+    return b == 0 ? 0.0 : (double)a / b;
+}
+
+/////////////////////// reports ///////////////////////
+
+void print_search_stats()
+{
+    uint64_t s[NUM_SEARCH_STATS];
+    collect_search_stats(s);
+    double elapsed = elapsed_seconds();
+
+    uint64_t probe_length = 0;
+    for (int i = 1; i < BUCKET_SIZE+1; i++) {
+        probe_length += i * s[STAT_TT_PROBE_LENGTH + i];
+    }
+
+    char line[512];
+    std::snprintf(line, sizeof(line),
+                  "[stats] %.1fs  nodes %llu (%.0f/s)  static %llu  db %llu/%llu (%.1f%% hit)  "
+                  "inverse %llu  etc %llu  pairs %llu  tt %llu/%llu (%.1f%% hit, %.2f slots/probe)\n",
+                  elapsed, (unsigned long long)s[STAT_NODES], s[STAT_NODES] / std::max(elapsed, 1e-9),
+                  (unsigned long long)s[STAT_STATIC_CUTOFFS],
+                  (unsigned long long)s[STAT_DB_HITS], (unsigned long long)(s[STAT_DB_HITS] + s[STAT_DB_MISSES]),
+                  100 * ratio(s[STAT_DB_HITS], s[STAT_DB_HITS] + s[STAT_DB_MISSES]),
+                  (unsigned long long)s[STAT_INVERSE_CANCELLATIONS], (unsigned long long)s[STAT_ETC_CUTOFFS],
+                  (unsigned long long)s[STAT_PAIR_DB_HITS],
+                  (unsigned long long)s[STAT_TT_HITS], (unsigned long long)s[STAT_TT_PROBES],
+                  100 * ratio(s[STAT_TT_HITS], s[STAT_TT_PROBES]), ratio(probe_length, s[STAT_TT_PROBES]));
+    std::cerr << line;
+}
+
+void dump_search_stats_json(std::ostream& os)
+{
+    uint64_t s[NUM_SEARCH_STATS];
+    collect_search_stats(s);
+    double elapsed = elapsed_seconds();
+
+    os << "{\n";
+    os << "  \"enabled\": " << (SEARCH_STATS_ENABLED ? "true" : "false") << ",\n";
+    os << "  \"elapsed_s\": " << elapsed << ",\n";
+    os << "  \"nodes\": " << s[STAT_NODES] << ",\n";
+    os << "  \"nodes_per_s\": " << (uint64_t)(s[STAT_NODES] / std::max(elapsed, 1e-9)) << ",\n";
+    os << "  \"static_cutoffs\": " << s[STAT_STATIC_CUTOFFS] << ",\n";
+    os << "  \"db_hits\": " << s[STAT_DB_HITS] << ",\n";
+    os << "  \"db_misses\": " << s[STAT_DB_MISSES] << ",\n";
+    os << "  \"inverse_cancellations\": " << s[STAT_INVERSE_CANCELLATIONS] << ",\n";
+    os << "  \"etc_cutoffs\": " << s[STAT_ETC_CUTOFFS] << ",\n";
+    os << "  \"pair_db_hits\": " << s[STAT_PAIR_DB_HITS] << ",\n";
+    os << "  \"tt_probes\": " << s[STAT_TT_PROBES] << ",\n";
+    os << "  \"tt_hits\": " << s[STAT_TT_HITS] << ",\n";
+    os << "  \"tt_hit_rate\": " << ratio(s[STAT_TT_HITS], s[STAT_TT_PROBES]) << ",\n";
+
+    // probe_lengths[i]: # of probes that read i slots
+    os << "  \"tt_probe_lengths\": [";
+    for (int i = 0; i < BUCKET_SIZE+1; i++) {
+        os << (i ? ", " : "") << s[STAT_TT_PROBE_LENGTH + i];
+    }
+    os << "],\n";
+
+    int max_depth = STATS_MAX_DEPTH;
+    while (max_depth > 0 && s[STAT_DEPTH_NODES + max_depth-1] == 0)
+        max_depth--;
+    os << "  \"depth_nodes\": [";
+    for (int i = 0; i < max_depth; i++) {
+        os << (i ? ", " : "") << s[STAT_DEPTH_NODES + i];
+    }
+    os << "]\n";
+    os << "}\n";
+}
+
+/////////////////////// reporter ///////////////////////
+
+static std::thread reporter;
+static std::atomic<bool> reporter_stop(false);
+
+void start_search_stats_reporter(double interval)
+{
+    stop_search_stats_reporter();
+    reporter_stop = false;
+    reporter = std::thread([interval]() {
+        const auto POLL = std::chrono::milliseconds(100);
+        auto next = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+        while (! reporter_stop.load()) {
+            std::this_thread::sleep_for(POLL);
+            bool due = interval > 0 && Clock::now() >= next;
+            if (report_requested.exchange(false) || due) {
+                print_search_stats();
+                if (due)
+                    next += std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(interval));
+            }
+        }
+    });
+}
+
+void stop_search_stats_reporter()
+{
+    if (reporter.joinable()) {
+        reporter_stop = true;
+        reporter.join();
+    }
+}
+
+void request_search_stats_report()
+{
+    report_requested.store(true);
+}
@@ -0,0 +1,83 @@
+#ifndef SEARCH_STATS_H
+#define SEARCH_STATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+
+#include "utils/hash_map.hpp"
+
+// Search counters, compiled in with -DSEARCH_STATS (make STATS=1) and to
+// nothing otherwise. Every thread bumps its own block of counters with
+// plain relaxed loads and stores; reports sum the blocks of all threads,
+// including those of threads that have already finished.
+
+const int STATS_MAX_DEPTH = 128;    // deeper nodes are counted in the last depth
+
+enum SearchStat
+{
+    STAT_NODES,
+    STAT_STATIC_CUTOFFS,
+    STAT_DB_HITS,
+    STAT_DB_MISSES,
+    STAT_INVERSE_CANCELLATIONS,
+    STAT_ETC_CUTOFFS,
+    STAT_PAIR_DB_HITS,                                          // static cutoffs by the pair DB
+    STAT_TT_PROBES,
+    STAT_TT_HITS,
+    STAT_TT_PROBE_LENGTH,                                       // + # of slots read
+    STAT_DEPTH_NODES = STAT_TT_PROBE_LENGTH + BUCKET_SIZE + 1,  // + depth
+    NUM_SEARCH_STATS = STAT_DEPTH_NODES + STATS_MAX_DEPTH
+};
+
+struct SearchStatsBlock
+{
+    std::atomic<uint64_t> counters[NUM_SEARCH_STATS];
+
+    SearchStatsBlock();
+    ~SearchStatsBlock();
+};
+
+extern thread_local SearchStatsBlock t_search_stats;
+
+inline void search_stats_add(int stat, uint64_t n=1)
+{
+    std::atomic<uint64_t>& counter = t_search_stats.counters[stat];
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+#ifdef SEARCH_STATS
+const bool SEARCH_STATS_ENABLED = true;
+#define STATS_INC(stat) search_stats_add(stat)
+#define STATS_DEPTH_NODE(depth) search_stats_add(STAT_DEPTH_NODES + std::min((int)(depth), STATS_MAX_DEPTH-1))
+#define STATS_TT_PROBE(length, hit) do { search_stats_add(STAT_TT_PROBES); \
+                                         search_stats_add(STAT_TT_PROBE_LENGTH + (length)); \
+                                         if (hit) search_stats_add(STAT_TT_HITS); } while (0)
+#else
+const bool SEARCH_STATS_ENABLED = false;
+#define STATS_INC(stat) ((void)0)
+#define STATS_DEPTH_NODE(depth) ((void)0)
+#define STATS_TT_PROBE(length, hit) ((void)0)
+#endif
+
+// sum of the counters of all threads
+void collect_search_stats(uint64_t totals[NUM_SEARCH_STATS]);
+
+// restart the clock that node rates are measured from
+void start_search_stats();
+
+// one-line summary on stderr
+void print_search_stats();
+
+void dump_search_stats_json(std::ostream& os);
+
+/* prints a summary every interval seconds, and whenever
+   request_search_stats_report() is called, e.g. from a SIGALRM handler */
+void start_search_stats_reporter(double interval);
+void stop_search_stats_reporter();
+
+/* async-signal-safe */
+void request_search_stats_report();
+
+#endif
@@ -1,19 +1,25 @@
-
 import subprocess
 
 def main():
-    command = './solver_main'
+    # the table file carries results over to later runs, and the checkpoint
+    # lets a rerun after a crash skip the root moves already refuted
+    command = ['./solver_main', '--batch', '--tt-file', 'linears.tt', '--checkpoint', 'linears.ckpt']
     toplay = 'w'
+    # one solver for all boards, so the DB is loaded once and the
+    # transposition table carries over from each board to the next
+    solver = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE, text=True)
     for i in range(16, 40):
         print("solving boardsize: 1x"+str(i))
         board = '.x' + '.' * (i-2)
-        result = subprocess.run([command, board, toplay], capture_output=True, text=True)
-        if (result.stderr):
-            print(result.stderr)
-        output = "boardsize: 1x" + str(i) + "\n" + result.stdout +"\n"
-        
+        solver.stdin.write(board + " " + toplay + "\n")
+        solver.stdin.flush()
+        result = solver.stdout.readline()
+        output = "boardsize: 1x" + str(i) + "\n" + result +"\n"
+
         with open("results.txt", "a") as f:
             f.write(output)
+    solver.stdin.close()
+    solver.wait()
 
 
 if __name__ == "__main__":
@@ -0,0 +1,40 @@
+import subprocess
+import time
+
+# fixed suite: (boards, player)
+SUITE = [
+    (['.x' + '.' * (n-2)], 'w') for n in range(20, 29, 2)
+] + [
+    (['.x' + '.' * 12, '..o' + '.' * 10], 'b'),
+    (['.' * 10, '.x' + '.' * 8, '..o....'], 'w'),
+]
+THREADS = [1, 2, 4, 8, 16]
+
+
+def solve(boards, toplay, num_threads):
+    command = ['./solver_main', '--threads', str(num_threads)] + boards + [toplay]
+    beg = time.time()
+    result = subprocess.run(command, capture_output=True, text=True)
+    end = time.time()
+    if (result.returncode):
+        print(result.stderr)
+    return result.stdout.split('\t')[0], end - beg
+
+
+def main():
+    print("threads\t" + "\t".join(str(t) for t in THREADS))
+    total = {t: 0.0 for t in THREADS}
+    for boards, toplay in SUITE:
+        times = {}
+        for t in THREADS:
+            outcome, times[t] = solve(boards, toplay, t)
+            total[t] += times[t]
+        row = ["%.2fs x%.2f" % (times[t], times[1] / times[t]) for t in THREADS]
+        print(" ".join(boards) + " " + toplay + " -> " + outcome)
+        print("\t" + "\t".join(row))
+    row = ["%.2fs x%.2f" % (total[t], total[1] / total[t]) for t in THREADS]
+    print("total\t" + "\t".join(row))
+
+
+if __name__ == "__main__":
+    main()
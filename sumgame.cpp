@@ -1,12 +1,18 @@
 #include <iostream>
 #include <utility>
+#include <thread>
 #include "unistd.h"
 
 #include "sumgame.hpp"
 #include "cache.hpp"
 #include "zobrist_hash.hpp"
+#include "search_stats.hpp"
+#include "move_ordering.hpp"
+#include "checkpoint.hpp"
+#include "pair_db.hpp"
 
 extern Cache cache;
+extern PairDB pair_db;
 extern ZobristHash hash;
 
 const int START_MARKER = 0;
@@ -15,24 +21,42 @@ const int ADD_MARKER = 2;
 
 /////////////////////// SumGame ///////////////////////
 
-SumGame::SumGame()
+SumGame::SumGame() : m_ordering(&index_move_ordering())
 {
-    m_subgames.reserve(100);
+    m_subgames.reserve(SUBGAMES_RESERVE);
+    m_record.reserve(RECORD_RESERVE);
+    m_order.reserve(RECORD_RESERVE);
+    m_moves.reserve(RECORD_RESERVE);
+    index_rebuild();
 }
 
-SumGame::SumGame(Game game)
+SumGame::SumGame(Game game) : m_ordering(&index_move_ordering())
 {
-    m_subgames.reserve(100);
+    m_subgames.reserve(SUBGAMES_RESERVE);
+    m_record.reserve(RECORD_RESERVE);
+    m_order.reserve(RECORD_RESERVE);
+    m_moves.reserve(RECORD_RESERVE);
+    hash_pair(hash, game.m_board, game.m_hash, game.m_inverse_hash);
     m_subgames.push_back(game);
+    m_hashcode += game.m_hash;
+    m_inverse_hashcode += game.m_inverse_hash;
+    index_rebuild();
 }
 
-SumGame::SumGame(std::vector<Game>& games)
+SumGame::SumGame(std::vector<Game>& games) : m_ordering(&index_move_ordering())
 {
-    m_subgames.reserve(100);
+    m_subgames.reserve(std::max((size_t)SUBGAMES_RESERVE, 2*games.size()));
+    m_record.reserve(RECORD_RESERVE);
+    m_order.reserve(RECORD_RESERVE);
+    m_moves.reserve(RECORD_RESERVE);
     for (Game& game : games) {
         assert(game.is_active());
         m_subgames.push_back(game);
+        hash_pair(hash, game.m_board, m_subgames.back().m_hash, m_subgames.back().m_inverse_hash);
+        m_hashcode += m_subgames.back().m_hash;
+        m_inverse_hashcode += m_subgames.back().m_inverse_hash;
     }
+    index_rebuild();
 }
 
 void SumGame::set_toplay(int color)
@@ -40,59 +64,115 @@ void SumGame::set_toplay(int color)
     m_toplay = color;
 }
 
-Game* SumGame::find_inverse(Game* candidate)
+// index of an active inverse of candidate, -1 if none
+int SumGame::find_inverse(const Game& candidate)
 {
-    assert(candidate->is_active());
-    for (auto& g : m_subgames) {
-        if (g.is_active() && g.is_inverse(*candidate)) {
-            return &g;
+    assert(candidate.is_active());
+    for (int i = m_buckets[bucket(candidate.m_board.inversed())]; i != -1; i = m_chain[i]) {
+        const Game& g = m_subgames[i];
+        if (g.is_active() && g.is_inverse(candidate)) {
+            STATS_INC(STAT_INVERSE_CANCELLATIONS);
+            return i;
         }
     }
-    return 0;
+    return -1;
 }
 
-bool SumGame::find_inactive(Game* candidate)
+bool SumGame::find_inactive(int idx)
 {
-    for (auto& g : m_subgames) {
-        if (&g == candidate) {
-            assert(! g.is_active());
-            return true;
-        }
+    return idx >= 0 && idx < (int)m_subgames.size() && ! m_subgames[idx].is_active();
+}
+
+void SumGame::index_rebuild()
+{
+    size_t num_buckets = 2 * SUBGAMES_RESERVE;
+    m_bucket_shift = 64 - 8;
+    while (num_buckets < 2 * m_subgames.size()) {
+        num_buckets *= 2;
+        m_bucket_shift--;
+    }
+    m_buckets.assign(num_buckets, -1);
+    m_chain.clear();
+    m_chain.reserve(num_buckets / 2);
+    for (int i = 0; i < (int)m_subgames.size(); i++) {
+        int b = bucket(m_subgames[i].m_board);
+        m_chain.push_back(m_buckets[b]);
+        m_buckets[b] = i;
     }
-    return false;
 }
 
-void SumGame::deactivate(Game* g)
+void SumGame::index_push()
 {
-    assert(g->is_active());
-    g->set_active(false);
-    m_record.push_back(std::make_pair(DEACTIVATE_MARKER, g));
+    if (2 * m_subgames.size() > m_buckets.size()) {
+        index_rebuild();
+        return;
+    }
+    int b = bucket(m_subgames.back().m_board);
+    m_chain.push_back(m_buckets[b]);
+    m_buckets[b] = (int)m_subgames.size()-1;
+}
+
+void SumGame::index_pop()
+{
+    int b = bucket(m_subgames.back().m_board);
+    assert(m_buckets[b] == (int)m_subgames.size()-1);
+    m_buckets[b] = m_chain.back();
+    m_chain.pop_back();
+}
+
+// G with color to play is -G with the opponent to play: both are keyed
+// by the smaller of the two sum hashes, so they share one TT entry
+uint64_t SumGame::tt_key(Color& color) const
+{
+    if (m_hashcode <= m_inverse_hashcode) {
+        color = m_toplay;
+        return m_hashcode;
+    }
+    color = opp_color(m_toplay);
+    return m_inverse_hashcode;
+}
+
+void SumGame::deactivate(int idx)
+{
+    Game& g = m_subgames[idx];
+    assert(g.is_active());
+    g.set_active(false);
+    m_hashcode -= g.m_hash;
+    m_inverse_hashcode -= g.m_inverse_hash;
+    m_record.push_back(std::make_pair(DEACTIVATE_MARKER, idx));
 }
 
 void SumGame::add(Game g)
 {
     g.m_board = ordered_symmetry(g.m_board);
+    hash_pair(hash, g.m_board, g.m_hash, g.m_inverse_hash);
+    m_hashcode += g.m_hash;
+    m_inverse_hashcode += g.m_inverse_hash;
     m_subgames.push_back(g);
+    index_push();
     assert(g.is_active());
-    m_record.push_back(std::make_pair(ADD_MARKER, &m_subgames.back()));
-    assert(m_subgames.size() <= 100);
+    m_record.push_back(std::make_pair(ADD_MARKER, (int)m_subgames.size()-1));
 }
 
-void SumGame::play(Game& g, int point, bool equivalent_replace)
+// play point in m_subgames[idx]; subgames are referred to by index, since
+// adding the results may reallocate m_subgames
+void SumGame::play(int idx, int point, bool equivalent_replace)
 {
-    std::vector<Game> candidates = g.play(point, m_toplay);
-    m_record.push_back(std::make_pair(START_MARKER, nullptr));
-    deactivate(&g);
+    Game candidates[MAX_PLAY_SUBGAMES];
+    int num_candidates = m_subgames[idx].play(point, m_toplay, candidates);
+    m_record.push_back(std::make_pair(START_MARKER, -1));
+    deactivate(idx);
 
-    if (candidates.size()==2 && candidates[0].is_inverse(candidates[1])) {
+    if (num_candidates==2 && candidates[0].is_inverse(candidates[1])) {
         return;
     }
 
-    for (auto& candidate : candidates) {
+    for (int i = 0; i < num_candidates; i++) {
+        Game& candidate = candidates[i];
         cache.lookup(candidate, equivalent_replace);
         if (!candidate.is_computed_zero()) {
-            Game* inverse = find_inverse(&candidate);
-            if (inverse) {
+            int inverse = find_inverse(candidate);
+            if (inverse != -1) {
                 deactivate(inverse);
             }
             else {
@@ -113,13 +193,19 @@ void SumGame::undo()
             break;
         }
         else if (p.first == DEACTIVATE_MARKER) {
-            Game* g = p.second;
-            assert(find_inactive(g));
-            g->set_active(true);
+            assert(find_inactive(p.second));
+            Game& g = m_subgames[p.second];
+            g.set_active(true);
+            m_hashcode += g.m_hash;
+            m_inverse_hashcode += g.m_inverse_hash;
         }
         else {
             assert(p.first == ADD_MARKER);
-            assert(p.second == &(m_subgames.back()));
+            assert(p.second == (int)m_subgames.size()-1);
+            assert(m_subgames.back().is_active());
+            m_hashcode -= m_subgames.back().m_hash;
+            m_inverse_hashcode -= m_subgames.back().m_inverse_hash;
+            index_pop();
             m_subgames.pop_back();
         }
     }
@@ -139,18 +225,18 @@ bool SumGame::static_winner(bool& toplay_win)
             assert(! g.is_zero());
             if (g.is_next_win()) {
                 if (has_next_win)
-                    return false;   // N + N = unknown
+                    return pair_winner(toplay_win);   // N + N = unknown
                 has_next_win = true;
             }
             else if (g.is_positive()) {
                 if (has_negative)
-                    return false;   // L + R = unknown
+                    return pair_winner(toplay_win);   // L + R = unknown
                 has_positive = true;
             }
             else {
                 assert(g.is_negative());
                 if (has_positive)
-                    return false;   // L + R = unknown
+                    return pair_winner(toplay_win);   // L + R = unknown
                 has_negative = true;
             }
         }
@@ -167,7 +253,7 @@ bool SumGame::static_winner(bool& toplay_win)
             return true;
         }
         else if (has_next_win) {
-            return false;   // R + N = unknown
+            return pair_winner(toplay_win);   // R + N = unknown
         }
         else {
             toplay_win = false; // R-psn only
@@ -180,7 +266,7 @@ bool SumGame::static_winner(bool& toplay_win)
             return true;
         }
         else if (has_next_win) {
-            return false;   // L + N = unknown
+            return pair_winner(toplay_win);   // L + N = unknown
         }
         else {
             toplay_win = false; // L-psn only
@@ -189,118 +275,289 @@ bool SumGame::static_winner(bool& toplay_win)
     }
 }
 
+// the sums static_winner cannot tell, when they are the pair DB's two components
+bool SumGame::pair_winner(bool& toplay_win) const
+{
+    if (pair_db.max_num_empty() == 0)
+        return false;
+    const Game* pair[2];
+    int num = 0;
+    for (const Game& g : m_subgames) {
+        if (g.is_active()) {
+            if (num == 2)
+                return false;
+            pair[num++] = &g;
+        }
+    }
+    if (num != 2)
+        return false;
+
+    int value = pair_db.lookup(*pair[0], *pair[1], m_toplay);
+    if (value == -1)
+        return false;
+    STATS_INC(STAT_PAIR_DB_HITS);
+    toplay_win = value;
+    return true;
+}
+
 bool SumGame::negamax(int depth)
 {
+    m_nodes++;
+    STATS_INC(STAT_NODES);
+    STATS_DEPTH_NODE(depth);
     bool toplay_win = false;
     bool found = static_winner(toplay_win);
-    if (found)
+    if (found) {
+        STATS_INC(STAT_STATIC_CUTOFFS);
         return toplay_win;
+    }
     
-    for (auto& g : m_subgames) {
-        if (g.is_active()) {
-            
-            std::vector<int> legal_points = g.legal_points(m_toplay);
-            int size = (int)legal_points.size();
-            for (int i = 0; i < size; i++) {
-                // int idx = 0;
-                int idx = (size-i) / 2;
-
-                play(g, legal_points[idx]);
-                m_toplay = opp_color(m_toplay);
-
-                toplay_win = ! negamax(depth+1);
-
-                undo();
-                m_toplay = opp_color(m_toplay);
-
-                if (toplay_win)
-                    return true;
-
-                legal_points.erase(legal_points.begin()+idx);
-            }
+    // this node's slice of m_moves, dropped before returning; moves are
+    // copied out of it, since deeper nodes may reallocate m_moves
+    size_t moves_begin = m_moves.size();
+    m_ordering->order(*this, depth, 0, m_moves);
+    size_t moves_end = m_moves.size();
+    for (size_t i = moves_begin; i < moves_end; i++) {
+        Move move = m_moves[i];
+        play(move.subgame, move.point);
+        m_toplay = opp_color(m_toplay);
+
+        toplay_win = ! negamax(depth+1);
+
+        undo();
+        m_toplay = opp_color(m_toplay);
+
+        if (toplay_win) {
+            m_ordering->cutoff(*this, move, depth);
+            m_moves.resize(moves_begin);
+            return true;
         }
     }
+    m_moves.resize(moves_begin);
     return false;
 }
 
 uint64_t SumGame::search_stats()
 {
-    return hash.size2();
+    return m_nodes;
+}
+
+/////////////////////// SearchControl ///////////////////////
+
+SearchControl::SearchControl(const SearchBudget& budget) : max_nodes(budget.max_nodes)
+{
+    if (budget.max_seconds > 0) {
+        has_deadline = true;
+        deadline = std::chrono::steady_clock::now()
+            + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(budget.max_seconds));
+    }
+}
+
+void SearchControl::charge(uint64_t num_nodes)
+{
+    uint64_t total = nodes.fetch_add(num_nodes, std::memory_order_relaxed) + num_nodes;
+    if ((max_nodes > 0 && total >= max_nodes) || (has_deadline && std::chrono::steady_clock::now() >= deadline)) {
+        // unless a thread has solved the root meanwhile
+        if (! stop.exchange(true))
+            out_of_budget = true;
+    }
 }
 
 /////////////////////// HashGame ///////////////////////
 
-bool HashGame::negamax(uint64_t hashcode, const std::vector<std::pair<Game, int>>& subgames, int depth)
+HashGame::HashGame() : SumGame(), m_tt(&hash)
+{
+    m_ordering = &default_move_ordering();
+}
+
+HashGame::HashGame(Game game) : SumGame(game), m_tt(&hash)
+{
+    m_ordering = &default_move_ordering();
+}
+
+HashGame::HashGame(std::vector<Game>& games) : SumGame(games), m_tt(&hash)
 {
-    int value = hash.get(hashcode, m_toplay);
+    m_ordering = &default_move_ordering();
+}
+
+bool HashGame::negamax(int depth)
+{
+    if (stopped())
+        return false;
+
+    Color color;
+    uint64_t hashcode = tt_key(color);
+    int value = m_tt->get(hashcode, color);
     if (value != -1)
         return value;
     
+    uint64_t start_nodes = m_nodes++;
+    STATS_INC(STAT_NODES);
+    STATS_DEPTH_NODE(depth);
+    if (m_control && m_nodes % BUDGET_CHECK_NODES == 0)
+        m_control->charge(BUDGET_CHECK_NODES);
     bool toplay_win = false;
     bool found = static_winner(toplay_win);
     if (found) {
-        hash.insert(hashcode, toplay_win, m_toplay);
+        STATS_INC(STAT_STATIC_CUTOFFS);
+        m_tt->insert(hashcode, toplay_win, color);
         return toplay_win;
     }
+
+    if (depth <= ETC_MAX_DEPTH && etc_win()) {
+        STATS_INC(STAT_ETC_CUTOFFS);
+        m_tt->insert(hashcode, true, color, m_nodes - start_nodes);
+        return true;
+    }
     
-    int subgames_size = (int)subgames.size();
-    for (int k = subgames_size-1; k >= 0; k--) {
-        auto& g = subgames[k];
-            
-        std::vector<int> legal_points = g.first.legal_points(m_toplay);
-        int size = (int)legal_points.size();
-        for (int i = 0; i < size; i++) {
-            int idx = (size-i) / 2;
-
-            play(m_subgames[g.second], legal_points[idx]);
-            m_toplay = opp_color(m_toplay);
-            std::vector<std::pair<Game, int>> next_subgames = sort_active_games(m_subgames);
-            uint64_t next_hashcode = hash_func(hash, next_subgames);
+    // this node's slice of m_moves, dropped before returning
+    size_t moves_begin = m_moves.size();
+    m_ordering->order(*this, depth, m_thread_id, m_moves);
+    size_t moves_end = m_moves.size();
+    // parallel_negamax searches the root at depth 1
+    RootProgress* root_progress = depth == 1 ? m_root_progress : nullptr;
+    for (size_t i = moves_begin; i < moves_end; i++) {
+        Move move = m_moves[i];
+        if (root_progress && root_progress->is_refuted(m_subgames[move.subgame], move.point))
+            continue;
+        play(move.subgame, move.point);
+        m_toplay = opp_color(m_toplay);
+
+        toplay_win = ! negamax(depth+1);
+
+        undo();
+        m_toplay = opp_color(m_toplay);
+
+        if (stopped()) {
+            m_moves.resize(moves_begin);
+            return false;   // aborted; the result is not used
+        }
 
-            toplay_win = ! negamax(next_hashcode, next_subgames, depth+1);
+        if (toplay_win) {
+            m_ordering->cutoff(*this, move, depth);
+            m_moves.resize(moves_begin);
+            m_tt->insert(hashcode, true, color, m_nodes - start_nodes);
+            return true;
+        }
+        if (root_progress)
+            root_progress->refute(m_subgames[move.subgame], move.point);
+    }
+    m_moves.resize(moves_begin);
+    m_tt->insert(hashcode, false, color, m_nodes - start_nodes);
+    return false;
+}
 
+// enhanced transposition cutoff: a win if any child is already known to
+// lose for the opponent. Child keys are computed a batch at a time, with
+// their buckets prefetched, so the probes of a batch overlap.
+bool HashGame::etc_win()
+{
+    uint64_t keys[ETC_BATCH];
+    Color colors[ETC_BATCH];
+    int num = 0;
+    int size = (int)m_subgames.size();
+    for (int j = 0; j < size; j++) {
+        if (! m_subgames[j].is_active())
+            continue;
+        for (uint64_t legal_points = m_subgames[j].legal_mask(m_toplay); legal_points; legal_points &= legal_points-1) {
+            play(j, __builtin_ctzll(legal_points));
+            m_toplay = opp_color(m_toplay);
+            keys[num] = tt_key(colors[num]);
+            m_tt->prefetch(keys[num]);
             undo();
             m_toplay = opp_color(m_toplay);
 
-            if (toplay_win) {
-                hash.insert(hashcode, true, m_toplay);
-                return true;
+            if (++num == ETC_BATCH) {
+                if (etc_probe(keys, colors, num))
+                    return true;
+                num = 0;
             }
+        }
+    }
+    return etc_probe(keys, colors, num);
+}
 
-            legal_points.erase(legal_points.begin()+idx);
-            }
+bool HashGame::etc_probe(const uint64_t* keys, const Color* colors, int num)
+{
+    for (int i = 0; i < num; i++) {
+        if (m_tt->get(keys[i], colors[i]) == 0)
+            return true;
     }
-    hash.insert(hashcode, false, m_toplay);
     return false;
 }
 
-// Select and sort active games in subgames; return list of <game, idx>
-std::vector<std::pair<Game, int>> sort_active_games(const std::vector<Game>& subgames)
+int parallel_negamax(const std::vector<Game>& games, Color toplay, int num_threads, uint64_t& nodes,
+                     const std::string& ordering, RootProgress* progress, const SearchBudget& budget)
 {
-    std::vector<std::pair<Game, int>> active_games;
-    int i = 0;
-    for (const Game& subgame : subgames) {
-        if (subgame.is_active()) {
-            std::pair<Game, int> p{subgame, i};
-            active_games.push_back(p);
-        }
-        i++;
+    assert(num_threads >= 1);
+    if (progress) {
+        std::vector<Game> root_games = games;
+        HashGame root(root_games);
+        root.set_toplay(toplay);
+        Color color;
+        uint64_t root_key = root.tt_key(color);
+        progress->start(root_key ^ (color == WHITE ? ~(uint64_t)0 : 0));
+    }
+    SearchControl control(budget);
+    bool win = false;
+    std::vector<uint64_t> thread_nodes(num_threads, 0);
+
+    auto worker = [&](int thread_id) {
+        std::vector<Game> subgames = games;
+        std::unique_ptr<MoveOrdering> thread_ordering = make_move_ordering(ordering);
+        assert(thread_ordering);
+        HashGame sumgame(subgames);
+        sumgame.m_ordering = thread_ordering.get();
+        sumgame.m_root_progress = progress;
+        sumgame.set_toplay(toplay);
+        sumgame.m_thread_id = thread_id;
+        sumgame.m_control = &control;
+        bool result = sumgame.negamax(1);
+        thread_nodes[thread_id] = sumgame.m_nodes;
+        if (! control.stop.exchange(true))
+            win = result;
+    };
+
+    std::vector<std::thread> helpers;
+    for (int t = 1; t < num_threads; t++) {
+        helpers.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& helper : helpers) {
+        helper.join();
     }
 
-    std::sort(active_games.begin(), active_games.end());
-
-    return active_games;
+    nodes = 0;
+    for (uint64_t n : thread_nodes) {
+        nodes += n;
+    }
+    if (control.out_of_budget)
+        return -1;
+    return win;
 }
 
-bool operator<(const std::pair<Game, int>& p1, const std::pair<Game, int>& p2)
+// Select and sort active games in subgames; append their indices to active_games
+int sort_active_games(const std::vector<Game>& subgames, std::vector<int>& active_games)
 {
-    return p1.first < p2.first;
+    size_t begin = active_games.size();
+    int size = (int)subgames.size();
+    for (int i = 0; i < size; i++) {
+        if (subgames[i].is_active()) {
+            active_games.push_back(i);
+        }
+    }
+
+    std::sort(active_games.begin() + begin, active_games.end(), [&subgames](int i, int j) {
+        return subgames[i] < subgames[j];
+    });
+
+    return (int)(active_games.size() - begin);
 }
 
 //////////////////////// HELPER ////////////////////////
 
-void print_search_stats()
+// SIGALRM: only flags a stats report, which the reporter thread prints
+void negamax_sig_handler(int signum)
 {
-    
-    return;
+    request_search_stats_report();
 }
@@ -1,8 +1,49 @@
 #ifndef SUMGAME_H
 #define SUMGAME_H
 
+#include <atomic>
+#include <chrono>
+#include <string>
+
 #include "game.hpp"
 
+class ZobristHash;
+class MoveOrdering;
+class RootProgress;
+
+const int SUBGAMES_RESERVE = 128;   // m_subgames grows past this when needed
+const int RECORD_RESERVE = 1024;    // undo records kept without reallocation
+const int ETC_MAX_DEPTH = 4;        // enhanced transposition cutoffs down to this depth
+const int ETC_BATCH = 16;           // child keys prefetched before they are probed
+const int BUDGET_CHECK_NODES = 1024;    // nodes a thread searches between budget checks
+
+struct Move
+{
+    int subgame;    // index into m_subgames
+    int point;
+};
+
+// node and wall-time budgets of a search; 0 is no limit
+struct SearchBudget
+{
+    uint64_t max_nodes = 0;
+    double max_seconds = 0;
+};
+
+// shared by the threads of a parallel_negamax
+struct SearchControl
+{
+    std::atomic<bool> stop{false};             // set once the root is solved, or out of budget
+    std::atomic<bool> out_of_budget{false};
+    std::atomic<uint64_t> nodes{0};            // of all threads, as charged so far
+    uint64_t max_nodes = 0;
+    bool has_deadline = false;
+    std::chrono::steady_clock::time_point deadline;
+
+    SearchControl(const SearchBudget& budget);
+    void charge(uint64_t num_nodes);    // stops the search once over budget
+};
+
 class SumGame
 {
 public:
@@ -13,10 +54,11 @@ public:
     void set_toplay(int color);
 
     void add(Game g);
-    void play(Game& g, int point, bool equivalent_replace=true);
+    void play(int idx, int point, bool equivalent_replace=true);
     void undo();
 
-    bool static_winner(bool& toplay_win);
+    bool static_winner(bool& toplay_win);    // consults the pair DB for two components
+    bool pair_winner(bool& toplay_win) const;
 
     bool negamax(int depth=0);
 
@@ -25,31 +67,68 @@ public:
 // private:
     Color m_toplay;
     std::vector<Game> m_subgames;
-    std::vector<std::pair<int, Game*>> m_record;
-
-    void deactivate(Game* g);
-
-    Game* find_inverse(Game* candidate);
-    bool find_inactive(Game* candidate);
+    std::vector<std::pair<int, int>> m_record;    // (marker, index into m_subgames)
+    std::vector<int> m_order;    // sorted active games, scratch of the orderings
+    std::vector<Move> m_moves;   // ordered moves, one slice per search depth
+    MoveOrdering* m_ordering;    // index_move_ordering(), default_move_ordering() for a HashGame
+    uint64_t m_hashcode = 0;    // sum of the hashes of active subgames
+    uint64_t m_inverse_hashcode = 0;    // and of their inverses, the hash of -G
+    uint64_t m_nodes = 0;
+
+    // inverse index: m_subgames chained by buckets of symmetric_key
+    std::vector<int> m_buckets;    // last subgame of each bucket, -1 if none
+    std::vector<int> m_chain;      // previous subgame in the same bucket
+    int m_bucket_shift = 64;
+
+    uint64_t tt_key(Color& color) const;
+
+    void deactivate(int idx);
+
+    int find_inverse(const Game& candidate);
+    bool find_inactive(int idx);
+
+    int bucket(const PackedBoard& board) const { return (int)(symmetric_key(board) >> m_bucket_shift); };
+    void index_rebuild();
+    void index_push();    // index m_subgames.back()
+    void index_pop();     // before m_subgames.pop_back()
 };
 
 class HashGame : public SumGame
 {
 public:
-    HashGame() : SumGame() { };
-    HashGame(Game game) : SumGame(game) { };
-    HashGame(std::vector<Game>& games) : SumGame(games) { };
+    HashGame();
+    HashGame(Game game);
+    HashGame(std::vector<Game>& games);
 
-    bool negamax(uint64_t hashcode, const std::vector<std::pair<Game, int>>& subgames, int depth=0);
-};
+    bool negamax(int depth=0);
 
-std::vector<std::pair<Game, int>> sort_active_games(const std::vector<Game>& subgames);
+    ZobristHash* m_tt;    // the global hash unless set otherwise
+    RootProgress* m_root_progress = nullptr;    // refuted root moves, for checkpoints
+    int m_thread_id = 0;
+    SearchControl* m_control = nullptr;
 
-bool operator<(const std::pair<Game, int>& p1, const std::pair<Game, int>& p2);
+    bool stopped() const { return m_control && m_control->stop.load(std::memory_order_relaxed); };
 
-void negamax_sig_handler(int signum);
+private:
+    bool etc_win();
+    bool etc_probe(const uint64_t* keys, const Color* colors, int num);
+};
 
-/* a helper function to be called in main */
-void print_search_stats();
+/* append the sorted indices of active games to active_games; return # of active games */
+int sort_active_games(const std::vector<Game>& subgames, std::vector<int>& active_games);
+
+/* Lazy SMP: num_threads HashGames search the sum at once and share the
+   transposition table; helpers reorder moves near the root, and the first
+   thread to finish stops the others; every thread orders its moves with
+   its own make_move_ordering(ordering). With a progress, root moves it
+   has refuted are skipped, and newly refuted ones are added to it.
+   Return 1 for a win, 0 for a loss, -1 if the budget ran out first; an
+   aborted search leaves only exact results in the transposition table,
+   so a later call with a larger budget goes on from there. */
+int parallel_negamax(const std::vector<Game>& games, Color toplay, int num_threads, uint64_t& nodes,
+                     const std::string& ordering="heat", RootProgress* progress=nullptr,
+                     const SearchBudget& budget=SearchBudget());
+
+void negamax_sig_handler(int signum);
 
 #endif
@@ -4,44 +4,137 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 typedef uint64_t    Entry;
+typedef std::atomic<Entry>  AtomicEntry;
 
+static_assert(sizeof(AtomicEntry) == sizeof(Entry) && AtomicEntry::is_always_lock_free,
+              "entries are read and written as lock-free 64-bit words");
+
+const int CACHE_LINE_SIZE = 64;
+const int BUCKET_SIZE = CACHE_LINE_SIZE / sizeof(Entry);   // # of entries per bucket
+
+// pool of zero-initialized entries, grouped in cache-line-aligned buckets;
+// every entry is a single atomic word, so threads can share the pool.
+// The pool is either allocated or a shared mapping of a file, in which
+// case every write reaches the file without any explicit save.
 class HashMap
 {
 public:
-    HashMap(uint64_t count, uint64_t entry_size);
-    ~HashMap() { std::free(m_pool); };
+    HashMap() { };
+    HashMap(uint64_t count) { allocate(count); };
+    ~HashMap() { release(); };
+
+    HashMap(const HashMap&) = delete;
+    HashMap& operator=(const HashMap&) = delete;
+
+    bool allocate(uint64_t count);
+    // maps path, created with count entries if missing; an existing file
+    // keeps its own count, and is refused unless written with the same tag
+    bool map_file(const std::string& path, uint64_t count, uint64_t tag);
+
+    Entry get(uint64_t idx) const { return m_pool[idx].load(std::memory_order_relaxed); };
+    void set(uint64_t idx, Entry entry) { m_pool[idx].store(entry, std::memory_order_relaxed); };
+    AtomicEntry* bucket(uint64_t bucket_idx) { return m_pool + bucket_idx * BUCKET_SIZE; };
 
-    Entry get(uint64_t idx);
-    void set(uint64_t idx, Entry entry);
+    uint64_t capacity() const { return m_capacity; };
+    bool is_mapped() const { return m_mapping != nullptr; };
 
 private:
-    unsigned char* m_pool;
+    // first cache line of a mapped file, followed by the entries
+    struct FileHeader
+    {
+        char magic[8];
+        uint64_t count;
+        uint64_t tag;
+    };
+    static constexpr char FILE_MAGIC[8] = {'N', 'O', 'G', 'O', 'T', 'T', '0', '1'};
 
-    uint64_t m_capacity;    // # of entries
-    uint64_t m_entry_size;
+    void* m_alloc = nullptr;
+    void* m_mapping = nullptr;
+    uint64_t m_mapping_size = 0;
+    AtomicEntry* m_pool = nullptr;
+
+    uint64_t m_capacity = 0;    // # of entries
+
+    void release();
 };
 
-inline HashMap::HashMap(uint64_t count, uint64_t entry_size)
-    : m_capacity(count), m_entry_size(entry_size)
+inline void HashMap::release()
 {
-    m_pool = (unsigned char*)std::calloc(m_capacity, m_entry_size);
+    std::free(m_alloc);
+    m_alloc = nullptr;
+    if (m_mapping != nullptr)
+        munmap(m_mapping, m_mapping_size);
+    m_mapping = nullptr;
+    m_pool = nullptr;
+    m_capacity = 0;
 }
 
-inline Entry HashMap::get(uint64_t idx)
+inline bool HashMap::allocate(uint64_t count)
 {
-    unsigned char* ptr = m_pool + idx * m_entry_size;
-    Entry entry = 0;
-    std::memcpy(&entry, ptr, m_entry_size);
-    return entry;
+    release();
+    // calloc keeps large pools lazily zeroed; align by hand
+    m_alloc = std::calloc(count * sizeof(Entry) + CACHE_LINE_SIZE, 1);
+    if (m_alloc == nullptr) {
+        m_pool = nullptr;
+        m_capacity = 0;
+        return false;
+    }
+    uintptr_t addr = (uintptr_t)m_alloc;
+    m_pool = (AtomicEntry*)((addr + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+    m_capacity = count;
+    return true;
 }
 
-inline void HashMap::set(uint64_t idx, Entry entry)
+inline bool HashMap::map_file(const std::string& path, uint64_t count, uint64_t tag)
 {
-    unsigned char* ptr = m_pool + idx * m_entry_size;
-    std::memcpy(ptr, &entry, m_entry_size);
-    return;
+    static_assert(sizeof(FileHeader) <= CACHE_LINE_SIZE, "the header fits in the first cache line");
+    release();
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    bool ok = fstat(fd, &st) == 0;
+    FileHeader header;
+    if (ok && st.st_size == 0) {
+        // new file: sparse, so its entries start as zeros
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+        header.count = count;
+        header.tag = tag;
+        ok = ftruncate(fd, CACHE_LINE_SIZE + count * sizeof(Entry)) == 0
+            && pwrite(fd, &header, sizeof(header), 0) == sizeof(header);
+    }
+    else if (ok) {
+        ok = pread(fd, &header, sizeof(header), 0) == sizeof(header)
+            && std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) == 0
+            && header.tag == tag
+            && (uint64_t)st.st_size == CACHE_LINE_SIZE + header.count * sizeof(Entry);
+    }
+    if (! ok) {
+        close(fd);
+        return false;
+    }
+
+    uint64_t size = CACHE_LINE_SIZE + header.count * sizeof(Entry);
+    void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return false;
+    m_mapping = mapping;
+    m_mapping_size = size;
+    // mappings are page-aligned, so the entries stay cache-line-aligned
+    m_pool = (AtomicEntry*)((char*)mapping + CACHE_LINE_SIZE);
+    m_capacity = header.count;
+    return true;
 }
 
 #endif
@@ -0,0 +1,39 @@
+#ifndef H_PARALLEL_FOR
+#define H_PARALLEL_FOR
+
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// run f(j) for every j in [0, total) on num_threads threads, in chunks
+template <typename F>
+void parallel_for(int64_t total, int num_threads, F f)
+{
+    const int64_t CHUNK_SIZE = 1024;
+
+    std::atomic<int64_t> next_chunk(0);
+    auto worker = [&]() {
+        for (;;) {
+            int64_t beg = next_chunk.fetch_add(1) * CHUNK_SIZE;
+            if (beg >= total)
+                break;
+            int64_t end = std::min(beg + CHUNK_SIZE, total);
+            for (int64_t j = beg; j < end; j++) {
+                f(j);
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; t++) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+#endif
@@ -2,80 +2,211 @@
 #define H_ZOBRIST_HASH
 
 #include <cassert>
+#include <algorithm>
+#include <string>
 #include <boost/random.hpp>
 
 #include "utils/hash_map.hpp"
+#include "search_stats.hpp"
 #include "game.hpp"
 
+const uint64_t MIN_TT_MB = 4;   // keeps at least 16 bits of bucket index
+
+// the largest power-of-2 # of buckets within budget
+inline uint64_t buckets_within(uint64_t megabytes)
+{
+    megabytes = std::max(megabytes, MIN_TT_MB);
+    uint64_t num_buckets = (megabytes << 20) / CACHE_LINE_SIZE;
+    while (num_buckets & (num_buckets - 1))
+        num_buckets &= num_buckets - 1;
+    return num_buckets;
+}
+
+inline uint64_t mix64(uint64_t x);
+
+// Transposition table of 64-bit entries in 64-byte buckets. A probe never
+// leaves its bucket; when a bucket is full, the entry with the smallest
+// searched subtree is replaced. Entries are read and written as whole
+// atomic words, so the table can be shared by search threads without
+// locks; a racing insert can only lose a result, never mix two keys.
+// Results are exact whatever the root, so entries stay valid across
+// searches; new_generation() only ages them: entries of an older
+// generation are replaced before any entry of the current one. For the
+// same reason the table can live in a file and grow across runs.
+//
+// entry layout: [63..16] key, [15..10] generation, [9..4] work, [3..0] flags
 class ZobristHash
 {
 public:
-    uint64_t m_rntable[4][64];
+    uint64_t m_rntable[4][MAX_BOARD_LEN+1];
 
-    ZobristHash(int IDX_bits, int CODE_bits, int ENTRY_bytes);
+    ZobristHash();
+    ZobristHash(uint64_t megabytes);
     ~ZobristHash() {};
 
-    void insert(uint64_t hashcode, int value, int color);
+    bool resize(uint64_t megabytes);
+    // table backed by path; a new file gets megabytes, an existing one
+    // keeps its size and entries
+    bool map_file(const std::string& path, uint64_t megabytes);
+    void new_generation();
+
+    void insert(uint64_t hashcode, int value, int color, uint64_t subtree_size=1);
     int get(uint64_t hashcode, int color);
+    void prefetch(uint64_t hashcode) { __builtin_prefetch(m_pool.bucket(hashcode & (m_num_buckets - 1))); };
+
+    // f(hashcode, info) for every occupied entry, info being the low 16
+    // bits of the entry; the hashcode is whole again, since the bucket
+    // index has at least the 16 bits the entry does not keep
+    template <typename F>
+    void for_each(F f);
+    // insert an entry given to f by for_each, into a table of any size
+    void restore(uint64_t hashcode, uint16_t info);
 
     uint64_t size() { return m_size; }
-    uint64_t size2() { return m_size2; }
+    uint64_t capacity() { return m_pool.capacity(); }
+    bool is_mapped() const { return m_pool.is_mapped(); }
 
 private:
-    int IDX_BITS, CODE_BITS, ENTRY_SIZE;
-    uint64_t m_capacity;    // # of entries
+    uint64_t m_num_buckets = 0;
     HashMap m_pool;
 
-    uint64_t m_size = 0;
-    uint64_t m_size2 = 0;
-    
-    uint64_t IDX_MASK, CODE_MASK;
-    Entry VLD_MASK, b_computed, b_win, w_computed, w_win;
-};
+    std::atomic<uint64_t> m_size{0};
+    Entry m_generation = 0;
 
-inline ZobristHash::ZobristHash(int IDX_bits, int CODE_bits, int ENTRY_bytes)
-    : IDX_BITS(IDX_bits), CODE_BITS(CODE_bits), ENTRY_SIZE(ENTRY_bytes),
-    m_capacity((uint64_t)1<<IDX_BITS), m_pool(HashMap(m_capacity, ENTRY_SIZE))
-{
-    assert(IDX_BITS+CODE_BITS <= 8*(int)sizeof(uint64_t));
-    assert(CODE_BITS+5 <= 8*ENTRY_SIZE);
-    IDX_MASK = (uint64_t)-1 >> (8*sizeof(uint64_t) - IDX_BITS) << CODE_BITS;
-    if (CODE_BITS == 0)
-        CODE_MASK = 0;
-    else
-        CODE_MASK = (uint64_t)-1 >> (8*sizeof(uint64_t) - CODE_BITS);
-    VLD_MASK = (Entry)1 << CODE_BITS;
-    b_computed = (Entry)1 << (CODE_BITS+1);
-    b_win = (Entry)1 << (CODE_BITS+2);
-    w_computed = (Entry)1 << (CODE_BITS+3);
-    w_win = (Entry)1 << (CODE_BITS+4);
+    uint64_t layout_tag() const;
 
+    static constexpr Entry b_computed = 1 << 0;
+    static constexpr Entry b_win = 1 << 1;
+    static constexpr Entry w_computed = 1 << 2;
+    static constexpr Entry w_win = 1 << 3;
+    static constexpr int WORK_SHIFT = 4;
+    static constexpr Entry WORK_MASK = (Entry)63 << WORK_SHIFT;
+    static constexpr int GENERATION_SHIFT = 10;
+    static constexpr Entry GENERATION_MASK = (Entry)63 << GENERATION_SHIFT;
+    static constexpr Entry KEY_MASK = (Entry)-1 << 16;
+};
+
+inline ZobristHash::ZobristHash()
+{
     boost::mt19937_64 rng(2024);
     for (int i = 0; i < 4; i++) {
-        for (int j = 0; j < 64; j++) {
+        for (int j = 0; j < MAX_BOARD_LEN+1; j++) {
             m_rntable[i][j] = rng();
         }
     }
 }
 
-inline void ZobristHash::insert(uint64_t hashcode, int value, int color)
+inline ZobristHash::ZobristHash(uint64_t megabytes) : ZobristHash()
 {
-    uint64_t idx = (hashcode & IDX_MASK) >> CODE_BITS;
-    uint64_t code = hashcode & CODE_MASK;
+    resize(megabytes);
+}
 
-    Entry entry;
-    while (true) {
-        entry = m_pool.get(idx);
-        if (entry == 0 || (entry & CODE_MASK) == code)
-            break;
-        idx = (idx + 1) % m_capacity;
+// a file is only read back by builds with the same random table and entry layout
+inline uint64_t ZobristHash::layout_tag() const
+{
+    uint64_t tag = KEY_MASK ^ GENERATION_MASK ^ WORK_MASK;
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < MAX_BOARD_LEN+1; j++) {
+            tag = mix64(tag ^ m_rntable[i][j]);
+        }
+    }
+    return tag;
+}
+
+// reallocate an empty table
+inline bool ZobristHash::resize(uint64_t megabytes)
+{
+    uint64_t num_buckets = buckets_within(megabytes);
+
+    m_size = 0;
+    m_generation = 0;
+    if (! m_pool.allocate(num_buckets * BUCKET_SIZE)) {
+        m_num_buckets = 0;
+        return false;
     }
+    m_num_buckets = num_buckets;
+    return true;
+}
+
+inline bool ZobristHash::map_file(const std::string& path, uint64_t megabytes)
+{
+    m_size = 0;
+    m_generation = 0;
+    m_num_buckets = 0;
+    if (! m_pool.map_file(path, buckets_within(megabytes) * BUCKET_SIZE, layout_tag()))
+        return false;
+    m_num_buckets = m_pool.capacity() / BUCKET_SIZE;
+    if (m_num_buckets == 0 || (m_num_buckets & (m_num_buckets - 1)))
+        return false;
+
+    // count the stored entries, and search on with the generation fewest
+    // of them carry, so that the stored ones are replaced first
+    uint64_t per_generation[64] = {0};
+    for (uint64_t b = 0; b < m_num_buckets; b++) {
+        AtomicEntry* bucket = m_pool.bucket(b);
+        for (int i = 0; i < BUCKET_SIZE; i++) {
+            Entry e = bucket[i].load(std::memory_order_relaxed);
+            if (e == 0)
+                break;
+            per_generation[(e & GENERATION_MASK) >> GENERATION_SHIFT]++;
+            m_size++;
+        }
+    }
+    int generation = std::min_element(per_generation, per_generation + 64) - per_generation;
+    m_generation = (Entry)generation << GENERATION_SHIFT;
+    return true;
+}
+
+// tags wrap around; an entry of 64 generations ago only looks fresh
+inline void ZobristHash::new_generation()
+{
+    m_generation = (m_generation + ((Entry)1 << GENERATION_SHIFT)) & GENERATION_MASK;
+}
+
+// the small table of the calling DB generation thread, for one more position:
+// a new generation only ages the earlier entries, which stay valid and are
+// replaced first
+inline ZobristHash& generation_tt()
+{
+    thread_local ZobristHash tt(MIN_TT_MB);
+    tt.new_generation();
+    return tt;
+}
 
-    m_size += entry == 0;
-    m_size2++;
+inline void ZobristHash::insert(uint64_t hashcode, int value, int color, uint64_t subtree_size)
+{
+    assert(m_num_buckets > 0);
+    AtomicEntry* bucket = m_pool.bucket(hashcode & (m_num_buckets - 1));
+    Entry key = hashcode & KEY_MASK;
+    Entry work = 64 - __builtin_clzll(subtree_size | 1);   // log2 of subtree size
+    if (work > 63)
+        work = 63;
 
-    entry |= VLD_MASK;
-    entry |= code;
+    // victim: an older generation first, then the smallest subtree
+    const Entry CURRENT = WORK_MASK + 1;
+    int slot = 0;
+    Entry min_value = 2 * CURRENT;
+    Entry entry = 0;
+    for (int i = 0; i < BUCKET_SIZE; i++) {
+        Entry e = bucket[i].load(std::memory_order_relaxed);
+        if (e == 0) {
+            slot = i;
+            m_size.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        if ((e & KEY_MASK) == key) {
+            slot = i;
+            entry = e;
+            work = std::max(work, (e & WORK_MASK) >> WORK_SHIFT);
+            break;
+        }
+        Entry value = (e & WORK_MASK) + ((e & GENERATION_MASK) == m_generation ? CURRENT : 0);
+        if (value < min_value) {
+            slot = i;
+            min_value = value;
+        }
+    }
+    entry = key | (entry & ~KEY_MASK & ~GENERATION_MASK & ~WORK_MASK) | m_generation | (work << WORK_SHIFT);
     if (color == BLACK) {
         entry |= b_computed;
         if (value != 0)
@@ -86,50 +217,140 @@ inline void ZobristHash::insert(uint64_t hashcode, int value, int color)
         if (value != 0)
             entry |= w_win;
     }
-    m_pool.set(idx, entry);
+    bucket[slot].store(entry, std::memory_order_relaxed);
 }
 
 inline int ZobristHash::get(uint64_t hashcode, int color)
 {
-    uint64_t idx = (hashcode & IDX_MASK) >> CODE_BITS;
-    uint64_t code = hashcode & CODE_MASK;
+    assert(m_num_buckets > 0);
+    AtomicEntry* bucket = m_pool.bucket(hashcode & (m_num_buckets - 1));
+    Entry key = hashcode & KEY_MASK;
 
-    Entry entry;
-    while (true) {
-        entry = m_pool.get(idx);
-        if (entry == 0 || (entry & CODE_MASK) == code)
+    Entry entry = 0;
+    int i = 0;
+    while (i < BUCKET_SIZE) {
+        Entry e = bucket[i++].load(std::memory_order_relaxed);
+        if (e == 0)
             break;
-        idx = (idx + 1) % m_capacity;
+        if ((e & KEY_MASK) == key) {
+            entry = e;
+            break;
+        }
     }
 
+    int value = -1;
     if (color == BLACK) {
-        if ((entry & b_computed) == 0)
-            return -1;
-        return (entry & b_win) != 0;
+        if (entry & b_computed)
+            value = (entry & b_win) != 0;
     }
     else {
-        if ((entry & w_computed) == 0)
-            return -1;
-        return (entry & w_win) != 0;
+        if (entry & w_computed)
+            value = (entry & w_win) != 0;
     }
+    STATS_TT_PROBE(i, value != -1);
+    return value;
+}
+
+template <typename F>
+inline void ZobristHash::for_each(F f)
+{
+    for (uint64_t b = 0; b < m_num_buckets; b++) {
+        AtomicEntry* bucket = m_pool.bucket(b);
+        for (int i = 0; i < BUCKET_SIZE; i++) {
+            Entry e = bucket[i].load(std::memory_order_relaxed);
+            if (e == 0)
+                break;
+            f((e & KEY_MASK) | (b & ~KEY_MASK), (uint16_t)e);
+        }
+    }
+}
+
+inline void ZobristHash::restore(uint64_t hashcode, uint16_t info)
+{
+    int work = (info & WORK_MASK) >> WORK_SHIFT;
+    uint64_t subtree_size = (uint64_t)1 << std::max(work - 1, 0);
+    if (info & b_computed)
+        insert(hashcode, (info & b_win) != 0, BLACK, subtree_size);
+    if (info & w_computed)
+        insert(hashcode, (info & w_win) != 0, WHITE, subtree_size);
 }
 
 //////////////////////// HASH_FUNC ////////////////////////
 
-inline uint64_t hash_func(const ZobristHash& hash, const std::vector<std::pair<Game, int>> subgames)
+// finalizer of splitmix64
+inline uint64_t mix64(uint64_t x)
 {
-    uint64_t hashcode = 0, idx = 0;
-    for (const auto& g : subgames) {
-        Board board = g.first.m_board;
-        for (Point point : board) {
-            hashcode ^= hash.m_rntable[point][idx];
-            idx++;
-        }
-        hashcode ^= hash.m_rntable[3][idx];
-        idx++;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111eb;
+    x ^= x >> 31;
+    return x;
+}
+
+// hash of a single component, the same for the board and its reverse;
+// mixed so that sums of component hashes are order-independent sum hashes
+inline uint64_t hash_func(const ZobristHash& hash, const PackedBoard& board)
+{
+    PackedBoard cboard = ordered_symmetry(board);
+    uint64_t hashcode = 0;
+    for (uint64_t bits = cboard.empty(); bits; bits &= bits-1) {
+        hashcode ^= hash.m_rntable[EMPTY][__builtin_ctzll(bits)];
+    }
+    for (uint64_t bits = cboard.black; bits; bits &= bits-1) {
+        hashcode ^= hash.m_rntable[BLACK][__builtin_ctzll(bits)];
+    }
+    for (uint64_t bits = cboard.white; bits; bits &= bits-1) {
+        hashcode ^= hash.m_rntable[WHITE][__builtin_ctzll(bits)];
+    }
+    hashcode ^= hash.m_rntable[3][cboard.size];
+    return mix64(hashcode);
+}
+
+// hash_func of a component and of its inverse, in one pass over the board
+inline void hash_pair(const ZobristHash& hash, const PackedBoard& board, uint64_t& hashcode, uint64_t& inverse_hashcode)
+{
+    int last = board.size - 1;
+    uint64_t forward = 0, reverse = 0;    // in the board's and the reverse's orientation
+    for (uint64_t bits = board.empty(); bits; bits &= bits-1) {
+        int i = __builtin_ctzll(bits);
+        forward ^= hash.m_rntable[EMPTY][i];
+        reverse ^= hash.m_rntable[EMPTY][last-i];
+    }
+    uint64_t inverse_forward = forward, inverse_reverse = reverse;
+    for (uint64_t bits = board.black; bits; bits &= bits-1) {
+        int i = __builtin_ctzll(bits);
+        forward ^= hash.m_rntable[BLACK][i];
+        reverse ^= hash.m_rntable[BLACK][last-i];
+        inverse_forward ^= hash.m_rntable[WHITE][i];
+        inverse_reverse ^= hash.m_rntable[WHITE][last-i];
+    }
+    for (uint64_t bits = board.white; bits; bits &= bits-1) {
+        int i = __builtin_ctzll(bits);
+        forward ^= hash.m_rntable[WHITE][i];
+        reverse ^= hash.m_rntable[WHITE][last-i];
+        inverse_forward ^= hash.m_rntable[BLACK][i];
+        inverse_reverse ^= hash.m_rntable[BLACK][last-i];
+    }
+
+    // pick the orientations ordered_symmetry would
+    PackedBoard reversed = board.reversed();
+    uint64_t size_key = hash.m_rntable[3][board.size];
+    hashcode = mix64((boardcmp(board, reversed) <= 0 ? forward : reverse) ^ size_key);
+    bool inverse_ordered = boardcmp(board.inversed(), reversed.inversed()) <= 0;
+    inverse_hashcode = mix64((inverse_ordered ? inverse_forward : inverse_reverse) ^ size_key);
+}
+
+inline uint64_t hash_func(const ZobristHash& hash, const Board& board)
+{
+    Board cboard = ordered_symmetry(board);
+    uint64_t hashcode = 0;
+    int size = cboard.size;
+    for (int i = 0; i < size; i++) {
+        hashcode ^= hash.m_rntable[cboard[i]][i];
     }
-    
-    return hashcode;
+    hashcode ^= hash.m_rntable[3][size];
+    return mix64(hashcode);
 }
 
 #endif